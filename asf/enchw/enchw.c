@@ -41,3 +41,21 @@ uint8_t enchw_exchangebyte(enchw_device_t *dev, uint8_t byte)
 	return rx;
 }
 
+
+/* The block functions follow the same locking rules as enchw_exchangebyte. */
+
+void enchw_readblock(enchw_device_t *dev, uint8_t *dest, uint16_t length)
+{
+	spi_read_buffer_wait(dev->pmaster, dest, length, 0);
+}
+
+void enchw_writeblock(enchw_device_t *dev, const uint8_t *src, uint16_t length)
+{
+	spi_write_buffer_wait(dev->pmaster, src, length);
+}
+
+void enchw_exchangeblock(enchw_device_t *dev, const uint8_t *src, uint8_t *dest, uint16_t length)
+{
+	// ASF does not declare tx_data const, but only reads from it
+	spi_transceive_buffer_wait(dev->pmaster, (uint8_t *)src, dest, length);
+}
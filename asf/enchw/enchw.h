@@ -10,3 +10,9 @@ void enchw_setup(enchw_device_t *dev);
 void enchw_select(enchw_device_t *dev);
 void enchw_unselect(enchw_device_t *dev);
 uint8_t enchw_exchangebyte(enchw_device_t *dev, uint8_t byte);
+
+/* Block transfers are mapped to ASF's buffer functions */
+#define ENCHW_HAS_BLOCKTRANSFER 1
+void enchw_readblock(enchw_device_t *dev, uint8_t *dest, uint16_t length);
+void enchw_writeblock(enchw_device_t *dev, const uint8_t *src, uint16_t length);
+void enchw_exchangeblock(enchw_device_t *dev, const uint8_t *src, uint8_t *dest, uint16_t length);
@@ -52,6 +52,8 @@
 #define EXT_USART USART1
 #define EXT_USART_CLOCK cmuClock_USART1
 #define EXT_USART_LOCATION 1
+#define EXT_USART_DMAREQ_RXDATAV DMAREQ_USART1_RXDATAV
+#define EXT_USART_DMAREQ_TXBL DMAREQ_USART1_TXBL
 
 #define EXT_LEUART LEUART0
 #define EXT_LEUART_CLOCK cmuClock_LEUART0
@@ -8,6 +8,7 @@
  *        4       (MOSI)          8
  *        6       (MISO)          7
  *        8       (CLCK)          9
+ *        3        (INT)          6
  *       19        (GND)          2
  *       20        (3V3)          1
  *
@@ -30,6 +31,12 @@
 #define RESET_PORT EXT5_PORT
 #define RESET_PIN EXT5_PIN
 
+#define HAS_INT_PIN 1
+#define INT_PORT EXT3_PORT
+#define INT_PIN EXT3_PIN
+
 #define USART EXT_USART
 #define USART_CLOCK EXT_USART_CLOCK
 #define USART_LOCATION EXT_USART_LOCATION
+#define USART_DMAREQ_RXDATAV EXT_USART_DMAREQ_RXDATAV
+#define USART_DMAREQ_TXBL EXT_USART_DMAREQ_TXBL
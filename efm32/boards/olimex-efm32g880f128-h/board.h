@@ -38,6 +38,8 @@
 #define UEXT_USART USART1
 #define UEXT_USART_CLOCK cmuClock_USART1
 #define UEXT_USART_LOCATION 1
+#define UEXT_USART_DMAREQ_RXDATAV DMAREQ_USART1_RXDATAV
+#define UEXT_USART_DMAREQ_TXBL DMAREQ_USART1_TXBL
 
 void board_setup(void);
 void led1_on(void);
@@ -12,6 +12,12 @@
 #define SCK_PORT UEXT9_PORT
 #define SCK_PIN UEXT9_PIN
 
+#define HAS_INT_PIN 1
+#define INT_PORT UEXT6_PORT
+#define INT_PIN UEXT6_PIN
+
 #define USART UEXT_USART
 #define USART_CLOCK UEXT_USART_CLOCK
 #define USART_LOCATION UEXT_USART_LOCATION
+#define USART_DMAREQ_RXDATAV UEXT_USART_DMAREQ_RXDATAV
+#define USART_DMAREQ_TXBL UEXT_USART_DMAREQ_TXBL
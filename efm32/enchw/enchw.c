@@ -4,26 +4,197 @@
  * enc28j60.c later */
 
 #include "enchw.h"
+#include <stddef.h>
 #include <em_gpio.h>
 #include <em_cmu.h>
 #include <em_usart.h>
 
 #include "enchw-config.h"
 
+#ifdef ENCHW_USE_DMA
+#include <em_dma.h>
+
+/* Channels used for bulk transfers; override in enchw-config.h if they
+ * collide with other DMA users. */
+#ifndef ENCHW_DMA_RX_CHANNEL
+#define ENCHW_DMA_RX_CHANNEL 0
+#endif
+#ifndef ENCHW_DMA_TX_CHANNEL
+#define ENCHW_DMA_TX_CHANNEL 1
+#endif
+
+/* Sized and aligned like emlib's dmactrl.c. Only used if the DMA controller
+ * was not set up by the application before enchw_setup; otherwise, the
+ * application's control block is reused. */
+#if DMA_CHAN_COUNT <= 4
+#define DMA_CONTROL_CHANNELS 4
+#elif DMA_CHAN_COUNT <= 8
+#define DMA_CONTROL_CHANNELS 8
+#else
+#define DMA_CONTROL_CHANNELS 16
+#endif
+static DMA_DESCRIPTOR_TypeDef dma_control_block[DMA_CONTROL_CHANNELS * 2] __attribute__((aligned(DMA_CONTROL_CHANNELS * 32)));
+
+/* A basic DMA cycle can move at most 1024 items, so longer transfers are
+ * split into chunks that get started from the completion interrupt. */
+#define DMA_MAX_CHUNK 1024
+
+static volatile bool dma_busy;
+static uint8_t *dma_dest;
+static const uint8_t *dma_src;
+static uint16_t dma_remaining;
+/* source of dummy bytes on reads, sink of discarded bytes on writes */
+static uint8_t dma_dummy;
+#endif
+
+/* SPI clock; override in enchw-config.h. The chip select timing below does
+ * not depend on it, so anything up to the ENC28J60's 20 MHz can be used as far
+ * as the board's wiring allows. */
+#ifndef ENCHW_BAUDRATE
+#define ENCHW_BAUDRATE 2000000
+#endif
+
 static USART_InitSync_TypeDef enc28j60_usart_config = {
     .enable = usartEnable,
     .refFreq = 0,
-    .baudrate = 2000000,  /* 2mhz works well with the current pause commands, 10mhz doesnt */
+    .baudrate = ENCHW_BAUDRATE,
     .databits = usartDatabits8,
     .master = true,
     .msbf = true,
     .clockMode = usartClockMode0,
   };
 
+/* Chip select timing from the datasheet's SPI characteristics (table 16-6),
+ * in ns: CS has to stay low for t_CSH after the last clock (10 ns for ETH
+ * registers, but 210 ns for MAC and MII registers, which the backend can not
+ * tell apart), and high for t_CSD between two commands. */
+#define T_CSH_NS 210
+#define T_CSD_NS 50
+/* Low time of the RESET pin (t_RSTLOW is 400 ns) */
+#define T_RSTLOW_NS 400
+
+/* Delays in iterations of delay(), calculated for the core clock and the SPI
+ * clock in delays_setup */
+static uint32_t delay_csh, delay_csd;
+
+/* Iterations of delay() that take at least ns nanoseconds: an iteration never
+ * takes less than one core cycle. */
+static uint32_t delay_iterations(uint32_t ns)
+{
+	return (uint64_t)ns * CMU_ClockFreqGet(cmuClock_CORE) / 1000000000 + 1;
+}
+
+static void delay(uint32_t iterations)
+{
+	for (volatile uint32_t n = iterations; n; --n);
+}
+
+static void delays_setup(void)
+{
+	/* the receiver has the last bit half an SPI clock before the clock
+	 * line's last edge */
+	delay_csh = delay_iterations(T_CSH_NS + 500000000 / USART_BaudrateGet(USART));
+	delay_csd = delay_iterations(T_CSD_NS);
+}
+
+#ifdef ENCHW_USE_DMA
+static void dma_chunk_start(void)
+{
+	uint16_t chunk = dma_remaining > DMA_MAX_CHUNK ? DMA_MAX_CHUNK : dma_remaining;
+
+	DMA_CfgDescr_TypeDef rxdescr = {
+		.dstInc = dma_dest ? dmaDataInc1 : dmaDataIncNone,
+		.srcInc = dmaDataIncNone,
+		.size = dmaDataSize1,
+		.arbRate = dmaArbitrate1,
+		.hprot = 0,
+	};
+	DMA_CfgDescr_TypeDef txdescr = {
+		.dstInc = dmaDataIncNone,
+		.srcInc = dma_src ? dmaDataInc1 : dmaDataIncNone,
+		.size = dmaDataSize1,
+		.arbRate = dmaArbitrate1,
+		.hprot = 0,
+	};
+
+	DMA_CfgDescr(ENCHW_DMA_RX_CHANNEL, true, &rxdescr);
+	DMA_CfgDescr(ENCHW_DMA_TX_CHANNEL, true, &txdescr);
 
-static volatile uint8_t j=0;
-#define pause() while(++j)
+	/* rx first, so no byte clocked in by the tx channel can get lost */
+	DMA_ActivateBasic(ENCHW_DMA_RX_CHANNEL, true, false,
+			dma_dest ? dma_dest : &dma_dummy, (void *)&USART->RXDATA, chunk - 1);
+	DMA_ActivateBasic(ENCHW_DMA_TX_CHANNEL, true, false,
+			(void *)&USART->TXDATA, dma_src ? (void *)dma_src : &dma_dummy, chunk - 1);
 
+	dma_remaining -= chunk;
+	if (dma_dest) dma_dest += chunk;
+	if (dma_src) dma_src += chunk;
+}
+
+/* Called from the DMA interrupt when the rx channel is done, which is when
+ * the last byte of a chunk has been completely clocked through the USART. */
+static void dma_done(unsigned int __attribute__((unused)) channel, bool __attribute__((unused)) primary, void __attribute__((unused)) *user)
+{
+	if (dma_remaining)
+		dma_chunk_start();
+	else
+		dma_busy = false;
+}
+
+static DMA_CB_TypeDef dma_callback = {
+	.cbFunc = dma_done,
+	.userPtr = NULL,
+	.primary = true,
+};
+
+static void dma_setup(void)
+{
+	CMU_ClockEnable(cmuClock_DMA, true);
+
+	if (!(DMA->STATUS & DMA_STATUS_EN)) {
+		DMA_Init_TypeDef init = {
+			.hprot = 0,
+			.controlBlock = dma_control_block,
+		};
+		DMA_Init(&init);
+	}
+
+	DMA_CfgChannel_TypeDef rxcfg = {
+		.highPri = true,
+		.enableInt = true,
+		.select = USART_DMAREQ_RXDATAV,
+		.cb = &dma_callback,
+	};
+	DMA_CfgChannel(ENCHW_DMA_RX_CHANNEL, &rxcfg);
+
+	DMA_CfgChannel_TypeDef txcfg = {
+		.highPri = false,
+		.enableInt = false,
+		.select = USART_DMAREQ_TXBL,
+		.cb = NULL,
+	};
+	DMA_CfgChannel(ENCHW_DMA_TX_CHANNEL, &txcfg);
+
+	dma_busy = false;
+}
+
+static void dma_start(uint8_t *dest, const uint8_t *src, uint16_t length)
+{
+	if (length == 0)
+		return;
+
+	dma_dest = dest;
+	dma_src = src;
+	dma_remaining = length;
+	dma_dummy = 0;
+	dma_busy = true;
+
+	dma_chunk_start();
+}
+#endif
+
+/* The chip select delays are calculated for the core clock at the time this
+ * is called; call it again after changing the core clock. */
 void enchw_setup(enchw_device_t __attribute__((unused)) *dev)
 {
 	CMU_ClockEnable(cmuClock_GPIO, true);
@@ -37,32 +208,59 @@ void enchw_setup(enchw_device_t __attribute__((unused)) *dev)
 
 #if HAS_RESET_PIN
 	GPIO_PinModeSet(RESET_PORT, RESET_PIN, gpioModePushPull, 0);
-	pause();
-	pause();
-	pause();
+	delay(delay_iterations(T_RSTLOW_NS));
 	GPIO_PinModeSet(RESET_PORT, RESET_PIN, gpioModePushPull, 1);
 #endif
 
+#if HAS_INT_PIN
+	/* INT is active low and open drain-ish enough for a pull-up not to hurt */
+	GPIO_PinModeSet(INT_PORT, INT_PIN, gpioModeInputPull, 1);
+	GPIO_IntConfig(INT_PORT, INT_PIN, false, true, true);
+	NVIC_ClearPendingIRQ((INT_PIN & 1) ? GPIO_ODD_IRQn : GPIO_EVEN_IRQn);
+	NVIC_EnableIRQ((INT_PIN & 1) ? GPIO_ODD_IRQn : GPIO_EVEN_IRQn);
+#endif
+
 	USART_Reset(USART);
 	USART_InitSync(USART, &enc28j60_usart_config);
+	delays_setup();
 
         /* routing setup: cs is done manually */
         USART->ROUTE = USART_ROUTE_TXPEN | USART_ROUTE_RXPEN | USART_ROUTE_CLKPEN | (USART_LOCATION << 8);
+
+#ifdef ENCHW_USE_DMA
+	dma_setup();
+#endif
 }
 
 void enchw_select(enchw_device_t __attribute__((unused)) *dev)
 {
-	/* this migh be relevant for t_{CSD}, especially when sending consecutive commands. */
-	pause();
+	/* t_CSS (50 ns) is covered by the time it takes to get the first byte
+	 * into the USART */
 	GPIO_PinOutClear(SS_PORT, SS_PIN);
 }
 
 void enchw_unselect(enchw_device_t __attribute__((unused)) *dev)
 {
-	/* if this pause is not observed, T_{CSH} will not be obeyed and writes
-	 * to MIREGADR will fail */
-	pause();
+	/* The last byte has been received completely; if t_CSH is not
+	 * observed after that, writes to MIREGADR fail. */
+	delay(delay_csh);
 	GPIO_PinOutSet(SS_PORT, SS_PIN);
+	/* t_CSD, for the next enchw_select */
+	delay(delay_csd);
+}
+
+uint32_t enchw_set_baudrate(enchw_device_t __attribute__((unused)) *dev, uint32_t baudrate)
+{
+	USART_BaudrateSyncSet(USART, 0, baudrate);
+	delays_setup();
+	/* for enchw_setup, eg. when enc_setup_basic runs again */
+	enc28j60_usart_config.baudrate = USART_BaudrateGet(USART);
+	return enc28j60_usart_config.baudrate;
+}
+
+uint32_t enchw_get_baudrate(enchw_device_t __attribute__((unused)) *dev)
+{
+	return USART_BaudrateGet(USART);
 }
 
 uint8_t enchw_exchangebyte(enchw_device_t __attribute__((unused)) *dev, uint8_t byte)
@@ -70,3 +268,113 @@ uint8_t enchw_exchangebyte(enchw_device_t __attribute__((unused)) *dev, uint8_t
 	USART_Tx(USART, byte);
 	return USART_Rx(USART);
 }
+
+bool enchw_interrupt_pending(enchw_device_t __attribute__((unused)) *dev)
+{
+#if HAS_INT_PIN
+	/* The line stays low as long as any enabled flag is set, so the level
+	 * is all that matters; the interrupt is only there for waking up. */
+	return !GPIO_PinInGet(INT_PORT, INT_PIN);
+#else
+	return true;
+#endif
+}
+
+#if HAS_INT_PIN
+/** Acknowledge the wake-up interrupt from the INT line. If the application
+ * needs the GPIO interrupt of the same parity for other pins too, it can
+ * define ENCHW_NO_GPIO_IRQHANDLER and call this from its own handler. */
+void enchw_gpio_irq(void)
+{
+	GPIO_IntClear(1 << INT_PIN);
+}
+
+#ifndef ENCHW_NO_GPIO_IRQHANDLER
+#if INT_PIN & 1
+void GPIO_ODD_IRQHandler(void)
+#else
+void GPIO_EVEN_IRQHandler(void)
+#endif
+{
+	enchw_gpio_irq();
+}
+#endif
+#endif
+
+/* Bulk exchange that keeps the USART busy back to back.
+ *
+ * USART_Tx / USART_Rx (as in enchw_exchangebyte) only queue the next byte
+ * after the previous one has been shifted in completely, so the clock pauses
+ * for the time the CPU needs to get from the RXDATAV flag to the next TXDATA
+ * write. Here, the next byte is queued as soon as the transmit buffer has
+ * room, while received bytes are collected in between. At most two bytes are
+ * in flight, which is what the two-level receive buffer can hold without
+ * overflowing even if the loop gets interrupted.
+ *
+ * Estimated from the instruction counts at -Os (not measured with the DWT
+ * cycle counter), per byte:
+ *
+ *   - per-byte path: 8 SPI clocks + about 30 core cycles of bus idle time
+ *     (two emlib calls, flag polling, loop);
+ *   - pipelined: 8 SPI clocks, as long as the loop body (about 15 cycles)
+ *     fits in a byte time.
+ *
+ * At 2 MHz SPI and a 28 MHz core (one byte = 112 cycles), a 1500 byte frame
+ * goes from about 213k to 168k cycles; at 8 MHz SPI (28 cycles per byte),
+ * from about 87k to 42k cycles.
+ *
+ * dest or src may be NULL to discard received bytes or to send zeros. */
+static void exchange_pipelined(const uint8_t *src, uint8_t *dest, uint16_t length)
+{
+	uint16_t sent = 0, received = 0;
+
+	while (received < length) {
+		if (USART->STATUS & USART_STATUS_RXDATAV) {
+			uint8_t byte = USART->RXDATA;
+			if (dest)
+				dest[received] = byte;
+			received++;
+		}
+		if (sent < length && sent - received < 2 && (USART->STATUS & USART_STATUS_TXBL)) {
+			USART->TXDATA = src ? src[sent] : 0;
+			sent++;
+		}
+	}
+}
+
+void enchw_readblock(enchw_device_t __attribute__((unused)) *dev, uint8_t *dest, uint16_t length)
+{
+	exchange_pipelined(NULL, dest, length);
+}
+
+void enchw_writeblock(enchw_device_t __attribute__((unused)) *dev, const uint8_t *src, uint16_t length)
+{
+	exchange_pipelined(src, NULL, length);
+}
+
+void enchw_exchangeblock(enchw_device_t __attribute__((unused)) *dev, const uint8_t *src, uint8_t *dest, uint16_t length)
+{
+	exchange_pipelined(src, dest, length);
+}
+
+#ifdef ENCHW_USE_DMA
+void enchw_readblock_start(enchw_device_t __attribute__((unused)) *dev, uint8_t *dest, uint16_t length)
+{
+	dma_start(dest, NULL, length);
+}
+
+void enchw_writeblock_start(enchw_device_t __attribute__((unused)) *dev, const uint8_t *src, uint16_t length)
+{
+	dma_start(NULL, src, length);
+}
+
+bool enchw_block_busy(enchw_device_t __attribute__((unused)) *dev)
+{
+	return dma_busy;
+}
+
+void enchw_block_wait(enchw_device_t __attribute__((unused)) *dev)
+{
+	while (dma_busy);
+}
+#endif
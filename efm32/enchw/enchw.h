@@ -1,4 +1,5 @@
 #include <stdint.h>
+#include <stdbool.h>
 
 typedef struct {
 } enchw_device_t;
@@ -7,3 +8,38 @@ void enchw_setup(enchw_device_t *dev);
 void enchw_select(enchw_device_t *dev);
 void enchw_unselect(enchw_device_t *dev);
 uint8_t enchw_exchangebyte(enchw_device_t *dev, uint8_t byte);
+
+/* This backend implements the optional block transfer functions; the driver
+ * uses them instead of looping over enchw_exchangebyte. */
+#define ENCHW_HAS_BLOCKTRANSFER 1
+void enchw_readblock(enchw_device_t *dev, uint8_t *dest, uint16_t length);
+void enchw_writeblock(enchw_device_t *dev, const uint8_t *src, uint16_t length);
+void enchw_exchangeblock(enchw_device_t *dev, const uint8_t *src, uint8_t *dest, uint16_t length);
+
+/* The SPI clock can be changed at runtime, eg. by enc_spi_calibrate. As the
+ * USART can only divide its reference clock, enchw_set_baudrate returns the
+ * rate in Hz it actually set; enchw_get_baudrate returns the current one. */
+#define ENCHW_HAS_BAUDRATE 1
+uint32_t enchw_set_baudrate(enchw_device_t *dev, uint32_t baudrate);
+uint32_t enchw_get_baudrate(enchw_device_t *dev);
+
+/* The state of the INT line can be queried if the board configuration
+ * defines HAS_INT_PIN; otherwise, enchw_interrupt_pending always returns
+ * true. A falling edge on the line also triggers a GPIO interrupt, which wakes
+ * the MCU from sleep modes down to EM3. */
+#define ENCHW_HAS_INTERRUPT 1
+bool enchw_interrupt_pending(enchw_device_t *dev);
+
+/* If built with ENCHW_USE_DMA, bulk transfers can also be run by the DMA
+ * controller in the background. A transfer started with one of the _start
+ * functions keeps the bus (and thus the chip select) until it has finished;
+ * completion can be polled with enchw_block_busy, and the DMA interrupt that
+ * signals it wakes the MCU from EM1. This needs USART_DMAREQ_RXDATAV and
+ * USART_DMAREQ_TXBL in enchw-config.h. */
+#ifdef ENCHW_USE_DMA
+#define ENCHW_HAS_ASYNC_BLOCKTRANSFER 1
+void enchw_readblock_start(enchw_device_t *dev, uint8_t *dest, uint16_t length);
+void enchw_writeblock_start(enchw_device_t *dev, const uint8_t *src, uint16_t length);
+bool enchw_block_busy(enchw_device_t *dev);
+void enchw_block_wait(enchw_device_t *dev);
+#endif
@@ -21,13 +21,10 @@
  * the user not to depend on knowledge of the implementation in order to
  * determine whether or not `rtc_maintenance` has to be called.)
  *
- * No part of the ENC28J60 driver (EMLIB hardware implementation, ENC28J60
- * driver logic and lwIP port) currently use this, but it is used in the
- * example provided (along with simple code gluing `sys_ticks` to the RTC
- * interface).
- *
- * It is expected that both the hardware implementation and the driver logic
- * will resort to using this for timeouts sooner or later.
+ * The ENC28J60 driver logic does not depend on this directly, but can be given
+ * `rtc_get32` and `rtc_get_ticks_per_second` as the `clock` and `clock_hz` of
+ * its device to bound its waits for the chip in time; the example provided
+ * does that (along with simple code gluing `sys_ticks` to the RTC interface).
  *
  * @file
  * */
@@ -26,13 +26,32 @@ typedef enum {
 	/* actual registers start here */
 
 	ENC_EIE = 0x1b | ENC_BANKALL,
+#define ENC_EIE_RXERIE 0x01
+#define ENC_EIE_TXERIE 0x02
+#define ENC_EIE_TXIE 0x08
+#define ENC_EIE_LINKIE 0x10
+#define ENC_EIE_DMAIE 0x20
+#define ENC_EIE_PKTIE 0x40
+#define ENC_EIE_INTIE 0x80
 	ENC_EIR = 0x1c | ENC_BANKALL,
+#define ENC_EIR_RXERIF 0x01
+#define ENC_EIR_TXERIF 0x02
+#define ENC_EIR_TXIF 0x08
+#define ENC_EIR_LINKIF 0x10
+#define ENC_EIR_DMAIF 0x20
+#define ENC_EIR_PKTIF 0x40
 	ENC_ESTAT = 0x1d | ENC_BANKALL,
 #define ENC_ESTAT_CLKRDY 0x01
+#define ENC_ESTAT_TXABRT 0x02
+#define ENC_ESTAT_RXBUSY 0x04
+#define ENC_ESTAT_LATECOL 0x10
+#define ENC_ESTAT_BUFER 0x40
+#define ENC_ESTAT_INT 0x80
 	ENC_ECON2 = 0x1e | ENC_BANKALL,
 #define ENC_ECON2_PKTDEC (1<<6)
 #define ENC_ECON2_AUTOINC (1<<7)
 	ENC_ECON1 = 0x1f | ENC_BANKALL,
+#define ENC_ECON1_BSEL 0x03
 #define ENC_ECON1_RXEN (1<<2)
 #define ENC_ECON1_TXRTS (1<<3)
 #define ENC_ECON1_CSUMEN (1<<4)
@@ -54,14 +73,46 @@ typedef enum {
 	ENC_ERXNDH = 0x0b | ENC_BANK0,
 	ENC_ERXRDPTL = 0x0c | ENC_BANK0,
 	ENC_ERXRDPTH = 0x0d | ENC_BANK0,
+	ENC_ERXWRPTL = 0x0e | ENC_BANK0,
+	ENC_ERXWRPTH = 0x0f | ENC_BANK0,
 	ENC_EDMASTL = 0x10 | ENC_BANK0,
 	ENC_EDMASTH = 0x11 | ENC_BANK0,
 	ENC_EDMANDL = 0x12 | ENC_BANK0,
 	ENC_EDMANDH = 0x13 | ENC_BANK0,
+	ENC_EDMADSTL = 0x14 | ENC_BANK0,
+	ENC_EDMADSTH = 0x15 | ENC_BANK0,
 	ENC_EDMACSL = 0x16 | ENC_BANK0,
 	ENC_EDMACSH = 0x17 | ENC_BANK0,
 
+	ENC_EHT0 = 0x00 | ENC_BANK1,
+	ENC_EHT1 = 0x01 | ENC_BANK1,
+	ENC_EHT2 = 0x02 | ENC_BANK1,
+	ENC_EHT3 = 0x03 | ENC_BANK1,
+	ENC_EHT4 = 0x04 | ENC_BANK1,
+	ENC_EHT5 = 0x05 | ENC_BANK1,
+	ENC_EHT6 = 0x06 | ENC_BANK1,
+	ENC_EHT7 = 0x07 | ENC_BANK1,
+	ENC_EPMM0 = 0x08 | ENC_BANK1,
+	ENC_EPMM1 = 0x09 | ENC_BANK1,
+	ENC_EPMM2 = 0x0a | ENC_BANK1,
+	ENC_EPMM3 = 0x0b | ENC_BANK1,
+	ENC_EPMM4 = 0x0c | ENC_BANK1,
+	ENC_EPMM5 = 0x0d | ENC_BANK1,
+	ENC_EPMM6 = 0x0e | ENC_BANK1,
+	ENC_EPMM7 = 0x0f | ENC_BANK1,
+	ENC_EPMCSL = 0x10 | ENC_BANK1,
+	ENC_EPMCSH = 0x11 | ENC_BANK1,
+	ENC_EPMOL = 0x14 | ENC_BANK1,
+	ENC_EPMOH = 0x15 | ENC_BANK1,
 	ENC_ERXFCON = 0x18 | ENC_BANK1,
+#define ENC_ERXFCON_BCEN 0x01
+#define ENC_ERXFCON_MCEN 0x02
+#define ENC_ERXFCON_HTEN 0x04
+#define ENC_ERXFCON_MPEN 0x08
+#define ENC_ERXFCON_PMEN 0x10
+#define ENC_ERXFCON_CRCEN 0x20
+#define ENC_ERXFCON_ANDOR 0x40
+#define ENC_ERXFCON_UCEN 0x80
 	ENC_EPKTCNT = 0x19 | ENC_BANK1,
 
 	ENC_MACON1 = 0x00 | ENC_BANK2,
@@ -72,13 +123,20 @@ typedef enum {
 	ENC_MACON2 = 0x01 | ENC_BANK2,
 #define ENC_MACON2_MARST 0x80
 	ENC_MACON3 = 0x02 | ENC_BANK2,
+#define ENC_MACON3_FULDPX 0x01
 #define ENC_MACON3_FRMLEN 0x02
 #define ENC_MACON3_TXCRCEN 0x10
 #define ENC_MACON3_FULLPADDING 0xe0
+	ENC_MACON4 = 0x03 | ENC_BANK2,
+#define ENC_MACON4_DEFER 0x40
+	ENC_MABBIPG = 0x04 | ENC_BANK2,
 	ENC_MAIPGL = 0x06 | ENC_BANK2,
 	ENC_MAIPGH = 0x07 | ENC_BANK2,
+	ENC_MAMXFLL = 0x0a | ENC_BANK2,
+	ENC_MAMXFLH = 0x0b | ENC_BANK2,
 	ENC_MICMD = 0x12 | ENC_BANK2,
 #define ENC_MICMD_MIIRD 1
+#define ENC_MICMD_MIISCAN 2
 	ENC_MIREGADR = 0x14 | ENC_BANK2,
 	ENC_MIWRL = 0x16 | ENC_BANK2,
 	ENC_MIWRH = 0x17 | ENC_BANK2,
@@ -103,24 +161,41 @@ typedef enum {
 	ENC_EBSTCSH = 0x09 | ENC_BANK3,
 	ENC_MISTAT = 0x0a | ENC_BANK3,
 #define ENC_MISTAT_BUSY 1
+#define ENC_MISTAT_SCAN 2
+#define ENC_MISTAT_NVALID 4
 	ENC_EREVID = 0x12 | ENC_BANK3,
 #define ENC_EREVID_B1 0x02
 #define ENC_EREVID_B4 0x04
 #define ENC_EREVID_B5 0x05
 #define ENC_EREVID_B7 0x06
+	ENC_EFLOCON = 0x17 | ENC_BANK3,
+#define ENC_EFLOCON_FCEN0 0x01
+#define ENC_EFLOCON_FCEN1 0x02
+#define ENC_EFLOCON_FULDPXS 0x04
+	ENC_EPAUSL = 0x18 | ENC_BANK3,
+	ENC_EPAUSH = 0x19 | ENC_BANK3,
 } enc_register_t;
 
 
 /* mii registers */
 typedef enum {
 	ENC_PHCON1 = 0x00,
+#define ENC_PHCON1_PDPXMD 0x0100
 	ENC_PHSTAT1 = 0x01,
+#define ENC_PHSTAT1_LLSTAT 0x0004
 	ENC_PHID1 = 0x02,
 	ENC_PHID2 = 0x03,
 	ENC_PHCON2 = 0x10,
+#define ENC_PHCON2_HDLDIS 0x0100
 	ENC_PHSTAT2 = 0x11,
+#define ENC_PHSTAT2_DPXSTAT 0x0200
+#define ENC_PHSTAT2_LSTAT 0x0400
 	ENC_PHIE = 0x12,
+#define ENC_PHIE_PGEIE 0x0002
+#define ENC_PHIE_PLNKIE 0x0010
 	ENC_PHIR = 0x13,
+#define ENC_PHIR_PGIF 0x0004
+#define ENC_PHIR_PLNKIF 0x0010
 	ENC_PHLCON = 0x14,
 } enc_phreg_t;
 
@@ -141,4 +216,19 @@ typedef enum {
 
 #define ENC_READLOCATION_ANY (uint16_t)(~0)
 
+/* bits 16 to 31 of the transmit status vector (table 7-1) */
+#define ENC_TSV_COLLISIONCOUNT 0x000f
+#define ENC_TSV_CRCERROR 0x0010
+#define ENC_TSV_LENGTHCHECKERROR 0x0020
+#define ENC_TSV_LENGTHOUTOFRANGE 0x0040
+#define ENC_TSV_DONE 0x0080
+#define ENC_TSV_MULTICAST 0x0100
+#define ENC_TSV_BROADCAST 0x0200
+#define ENC_TSV_DEFER 0x0400
+#define ENC_TSV_EXCESSIVEDEFER 0x0800
+#define ENC_TSV_EXCESSIVECOLLISION 0x1000
+#define ENC_TSV_LATECOLLISION 0x2000
+#define ENC_TSV_GIANT 0x4000
+#define ENC_TSV_UNDERRUN 0x8000
+
 /** @} @} */
@@ -8,11 +8,36 @@
  *
  * Documentation references in here are relative to the ENC28J60 Data Sheet
  * DS39662D
+ *
+ * Buffer memory transfers use the backend's `enchw_readblock` /
+ * `enchw_writeblock` (and register commands `enchw_exchangeblock`) if the
+ * backend announces them by defining `ENCHW_HAS_BLOCKTRANSFER` in its
+ * `enchw.h`; otherwise, everything is done byte by byte.
+ *
+ * If the backend can change its SPI clock (`ENCHW_HAS_BAUDRATE`, with
+ * `enchw_set_baudrate` and `enchw_get_baudrate`), @ref enc_spi_calibrate
+ * finds the fastest clock the board's wiring allows.
+ *
+ * With `ENC28J60_RX_POOL` (which requires `ENC28J60_USE_PBUF` and lwIP's
+ * `LWIP_SUPPORT_CUSTOM_PBUF`), received frames are read into pbufs from a
+ * fixed pool of segments owned by the driver instead of lwIP's heap.
  * */
 
+#include <string.h>
+
 #include "enchw.h"
 #include "enc28j60.h"
 
+#ifdef ENC28J60_RX_POOL
+#ifndef ENC28J60_USE_PBUF
+#error "ENC28J60_RX_POOL requires ENC28J60_USE_PBUF"
+#endif
+#if !LWIP_SUPPORT_CUSTOM_PBUF
+#error "ENC28J60_RX_POOL requires LWIP_SUPPORT_CUSTOM_PBUF"
+#endif
+#include <lwip/sys.h>
+#endif
+
 #if defined(ENC28J60_USE_PBUF) && !defined(DEBUG)
 #define DEBUG(...) LWIP_DEBUGF(NETIF_DEBUG, (__VA_ARGS__))
 #endif
@@ -24,6 +49,113 @@
 /** This access/cast happens too often to be written out explicitly */
 #define HWDEV (enchw_device_t*)dev->hwdev
 
+/** @{ Bits in enc_device_t's shadow.valid */
+#define SHADOW_ETXST 0x01
+#define SHADOW_ERXFCON 0x02
+#define SHADOW_MACON1 0x04
+#define SHADOW_MACON3 0x08
+#define SHADOW_PHLCON 0x10
+/** @} */
+
+/** @{ Values of enc_device_t's mii_scan */
+#define MII_SCAN_OFF 0
+#define MII_SCAN_RUNNING 1
+#define MII_SCAN_RESTARTED 2
+/** @} */
+
+/* Upper bounds for waiting on the chip, in microseconds, derived from the
+ * datasheet with a generous margin. They are only measured if the device has
+ * a clock; otherwise, the register reads are counted (the *_POLLS values),
+ * which takes longer the faster the SPI bus is. */
+/* Oscillator start-up timer: 300us after power-up or reset (2.2); the power
+ * supply may take a while longer */
+#define WAIT_CLKRDY_US 50000
+#define WAIT_CLKRDY_POLLS 100000
+/* Time ESTAT has to read the same to be believed (see enc_wait) */
+#define WAIT_STABLE_US 250
+#define WAIT_STABLE_POLLS 100
+/* MII operations take 10.24us (3.3) */
+#define WAIT_MII_US 50
+#define WAIT_MII_POLLS 10000
+/* The DMA engine is done with all of the 8 KiB in well under a millisecond */
+#define WAIT_DMA_US 2000
+#define WAIT_DMA_POLLS 10000
+/* After a soft reset, CLKRDY can't be trusted for 1ms (errata #2) */
+#define WAIT_SRC_US 1000
+#define WAIT_SRC_POLLS 2000
+/* Receiving a full sized frame takes 1.2ms at 10 Mbit/s */
+#define WAIT_RXBUSY_US 2000
+#define WAIT_RXBUSY_POLLS 10000
+
+/* Ticks of dev->clock that span at least us microseconds, counting the
+ * current tick as partial */
+static uint32_t clock_ticks(enc_device_t *dev, uint32_t us)
+{
+	return ((uint64_t)us * dev->clock_hz + 999999) / 1000000 + 1;
+}
+
+/* Non-zero if dev->clock has reached deadline */
+static int clock_passed(enc_device_t *dev, uint32_t deadline)
+{
+	return (int32_t)(dev->clock() - deadline) >= 0;
+}
+
+/* End of a wait: a clock value if the device has a clock, or else a number
+ * of polls left */
+typedef struct {
+	uint32_t end;
+	uint32_t polls;
+} deadline_t;
+
+static void deadline_start(enc_device_t *dev, deadline_t *deadline, uint32_t us, uint32_t polls)
+{
+	if (dev->clock != NULL)
+		deadline->end = dev->clock() + clock_ticks(dev, us);
+	deadline->polls = polls;
+}
+
+/* Non-zero once the deadline has passed; without a clock, each call counts
+ * as a poll */
+static int deadline_passed(enc_device_t *dev, deadline_t *deadline)
+{
+	if (dev->clock != NULL)
+		return clock_passed(dev, deadline->end);
+	if (deadline->polls == 0)
+		return 1;
+	deadline->polls--;
+	return 0;
+}
+
+/* Poll reg until the bits in mask are clear. Returns 0 on success, or
+ * non-zero if the deadline passed first, which is also counted in
+ * wait_timeouts. */
+static int wait_clear(enc_device_t *dev, enc_register_t reg, uint8_t mask, uint32_t us, uint32_t polls)
+{
+	deadline_t deadline;
+
+	deadline_start(dev, &deadline, us, polls);
+	while (enc_RCR(dev, reg) & mask) {
+		if (deadline_passed(dev, &deadline)) {
+			DEBUG("Timeout waiting for register %02x & %02x to clear.\n", reg, mask);
+			dev->wait_timeouts++;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* Forget everything that was cached about the chip's state, eg. after a
+ * reset */
+static void invalidate_cache(enc_device_t *dev)
+{
+	dev->last_used_register = ENC_BANK_INDETERMINATE;
+	dev->rxbufsize = ~0;
+	dev->shadow.valid = 0;
+	dev->mii_scan = MII_SCAN_OFF;
+	/* a reset returns ERXFCON to its default */
+	dev->wake_filters_only = 0;
+}
+
 /** Initialize an ENC28J60 device. Returns 0 on success, or an unspecified
  * error code if something goes wrong.
  *
@@ -38,8 +170,30 @@ int enc_setup_basic(enc_device_t *dev)
 	if (enc_wait(dev))
 		return 1;
 
-	dev->last_used_register = ENC_BANK_INDETERMINATE;
-	dev->rxbufsize = ~0;
+	invalidate_cache(dev);
+	dev->bank_switches_saved = 0;
+	dev->transfer_pending = 0;
+	dev->tx.count = 0;
+	dev->tx.queued = 0;
+	dev->tx.active = 0;
+	memset(&dev->txstats, 0, sizeof(dev->txstats));
+	dev->rx_overflows = 0;
+	dev->wait_timeouts = 0;
+	dev->flow_active = 0;
+	memset(&dev->adapt, 0, sizeof(dev->adapt));
+	memset(dev->multicast_refs, 0, sizeof(dev->multicast_refs));
+	dev->tx_done = NULL;
+	dev->offload = 0;
+	dev->rx_checksum_errors = 0;
+	dev->fast_reply = 0;
+	dev->fast_replies = 0;
+	dev->rx_filter = NULL;
+	dev->rx_rules = NULL;
+	dev->rx_rule_count = 0;
+	dev->rx_filtered = 0;
+#ifdef ENC28J60_USE_PBUF
+	dev->rx_pending = NULL;
+#endif
 
 	uint8_t revid = enc_RCR(dev, ENC_EREVID);
 	if (revid != ENC_EREVID_B1 && revid != ENC_EREVID_B4 &&
@@ -54,11 +208,60 @@ int enc_setup_basic(enc_device_t *dev)
 static void set_erxnd(enc_device_t *dev, uint16_t erxnd)
 {
 	if (erxnd != dev->rxbufsize) {
-		dev->rxbufsize = erxnd;
 		enc_WCR16(dev, ENC_ERXNDL, erxnd);
+		dev->rxbufsize = erxnd;
 	}
 }
 
+/* ERXND, the last address of the receive buffer; read from the chip again if
+ * the cached value was invalidated by a direct register write */
+static uint16_t get_erxnd(enc_device_t *dev)
+{
+	if (dev->rxbufsize == (uint16_t)~0)
+		dev->rxbufsize = enc_RCR16(dev, ENC_ERXNDL);
+	return dev->rxbufsize;
+}
+
+static void set_etxst(enc_device_t *dev, uint16_t etxst)
+{
+	if ((dev->shadow.valid & SHADOW_ETXST) && dev->shadow.etxst == etxst)
+		return;
+
+	enc_WCR16(dev, ENC_ETXSTL, etxst);
+	dev->shadow.etxst = etxst;
+	dev->shadow.valid |= SHADOW_ETXST;
+}
+
+/* Compute the IP checksum over buffer memory start to end (inclusive), using
+ * the DMA checksum engine (14.2), into checksum. The value is in the order of
+ * a 16-bit word read from a frame: the first byte is the high byte. Returns
+ * 0 on success, or non-zero if the engine did not finish in time. */
+static int dma_checksum(enc_device_t *dev, uint16_t start, uint16_t end, uint16_t *checksum)
+{
+	enc_WCR16(dev, ENC_EDMASTL, start);
+	enc_WCR16(dev, ENC_EDMANDL, end);
+	enc_BFS(dev, ENC_ECON1, ENC_ECON1_CSUMEN | ENC_ECON1_DMAST);
+	if (wait_clear(dev, ENC_ECON1, ENC_ECON1_DMAST, WAIT_DMA_US, WAIT_DMA_POLLS) != 0)
+		return 1;
+	*checksum = enc_RCR16(dev, ENC_EDMACSL);
+	return 0;
+}
+
+#ifdef ENC28J60_USE_PBUF
+/* Copy the buffer memory from start to end to dest with the DMA engine; the
+ * source range wraps around the receive buffer like the receiver does.
+ * Returns 0 on success, or non-zero if the engine did not finish in time. */
+static int dma_copy(enc_device_t *dev, uint16_t start, uint16_t end, uint16_t dest)
+{
+	enc_WCR16(dev, ENC_EDMASTL, start);
+	enc_WCR16(dev, ENC_EDMANDL, end);
+	enc_WCR16(dev, ENC_EDMADSTL, dest);
+	enc_BFC(dev, ENC_ECON1, ENC_ECON1_CSUMEN);
+	enc_BFS(dev, ENC_ECON1, ENC_ECON1_DMAST);
+	return wait_clear(dev, ENC_ECON1, ENC_ECON1_DMAST, WAIT_DMA_US, WAIT_DMA_POLLS);
+}
+#endif
+
 /** Run the built-in diagnostics. Returns 0 on success or an unspecified
  * error code.
  *
@@ -84,20 +287,25 @@ uint8_t enc_bist(enc_device_t *dev)
 //	enc_WCR(dev, ENC_EBSTCON, ENC_EBSTCON_ADDRESSFILL | ENC_EBSTCON_PSEL | ENC_EBSTCON_TME);
 	/* 6. */
 	enc_BFS(dev, ENC_EBSTCON, ENC_EBSTCON_BISTST);
-	/* wait a second -- never took any time yet */
-	while(enc_RCR(dev, ENC_EBSTCON) & ENC_EBSTCON_BISTST)
-		DEBUG("(%02x)", enc_RCR(dev, ENC_EBSTCON));
+	/* never took any time yet */
+	if (wait_clear(dev, ENC_EBSTCON, ENC_EBSTCON_BISTST, WAIT_DMA_US, WAIT_DMA_POLLS))
+		return 1;
 	/* 7. */
 	enc_BFS(dev, ENC_ECON1, ENC_ECON1_DMAST);
 	/* 8. */
-	while(enc_RCR(dev, ENC_ECON1) & ENC_ECON1_DMAST)
-		DEBUG("[%02x]", enc_RCR(dev, ENC_ECON1));
+	if (wait_clear(dev, ENC_ECON1, ENC_ECON1_DMAST, WAIT_DMA_US, WAIT_DMA_POLLS))
+		return 1;
 
 	/* 9.: @todo pull this in */
 
 	return 0;
 }
 
+static uint8_t bist_pattern(uint16_t address)
+{
+	return ((address >> 8) + (address & 0xff)) % 256;
+}
+
 /* Similar check to enc_bist, but doesn't rely on the BIST of the chip but
  * doesn some own reading and writing */
 uint8_t enc_bist_manual(enc_device_t *dev)
@@ -105,13 +313,15 @@ uint8_t enc_bist_manual(enc_device_t *dev)
 	uint16_t address;
 	uint8_t buffer[256];
 	int i;
+	uint32_t sum = 0;
+	uint16_t checksum;
 
 	set_erxnd(dev, ENC_RAMSIZE-1);
 
 	for (address = 0; address < ENC_RAMSIZE; address += 256)
 	{
 		for (i = 0; i < 256; ++i)
-			buffer[i] = ((address >> 8) + i) % 256;
+			buffer[i] = bist_pattern(address + i);
 
 		enc_WBM(dev, buffer, address, 256);
 	}
@@ -121,41 +331,287 @@ uint8_t enc_bist_manual(enc_device_t *dev)
 		enc_RBM(dev, buffer, address, 256);
 
 		for (i = 0; i < 256; ++i)
-			if (buffer[i] != ((address >> 8) + i) % 256)
+			if (buffer[i] != bist_pattern(address + i))
 				return 1;
 	}
 
-	/* dma checksum */
+	/* dma checksum, as it is used for offloading; the pattern's words
+	 * are summed up on the MCU for comparison */
+	for (address = 0; address < ENC_RAMSIZE; address += 2)
+		sum += (bist_pattern(address) << 8) | bist_pattern(address + 1);
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+
+	if (dma_checksum(dev, 0, ENC_RAMSIZE - 1, &checksum) != 0 || checksum != (~sum & 0xffff))
+		return 2;
+
+	return 0;
+}
+
+#ifdef ENCHW_HAS_BAUDRATE
+/* MAMXFL after reset; spi_pattern_test overwrites it */
+#define MAMXFL_DEFAULT 1518
+
+/* Register round trips (an ETH register and a MAC register, which have
+ * different timing requirements) followed by enc_bist_manual. Returns 0 if
+ * everything read back as written. */
+static int spi_pattern_test(enc_device_t *dev)
+{
+	static const uint16_t patterns[] = {0x0000, 0xffff, 0x55aa, 0xaa55, 0x0ff0, 0x1234};
+	unsigned int i;
+
+	for (i = 0; i < sizeof(patterns) / sizeof(*patterns); ++i) {
+		enc_WCR16(dev, ENC_EWRPTL, patterns[i] & 0x1fff);
+		if (enc_RCR16(dev, ENC_EWRPTL) != (patterns[i] & 0x1fff))
+			return 1;
+		enc_WCR16(dev, ENC_MAMXFLL, patterns[i]);
+		if (enc_RCR16(dev, ENC_MAMXFLL) != patterns[i])
+			return 1;
+	}
+
+	return enc_bist_manual(dev);
+}
 
-	/* we don't use dma at all, so we can just as well not test it.
-	enc_WCR16(ENC_EDMASTL, 0);
-	enc_WCR16(ENC_EDMANDL, ENC_RAMSIZE-1);
+/** Find the fastest SPI clock up to max_hz (at most @ref ENC_SPI_MAX_HZ) at
+ * which the chip works reliably, and leave the backend set to that clock less
+ * @ref ENC_SPI_MARGIN percent (but not below the clock it started with).
+ * Returns the resulting clock in Hz as reported by the backend, or 0 if even
+ * the initial clock fails the tests.
+ *
+ * Starting from the backend's current clock, the clock is raised by a quarter
+ * at a time, and register and buffer memory round trips are tested at each
+ * step. As this overwrites the buffer memory and ends with a soft reset of the
+ * chip, it has to be run after @ref enc_setup_basic and before @ref
+ * enc_ethernet_setup, like the self tests. The backend keeps the resulting
+ * clock even if enchw_setup runs again.
+ *
+ * Only available if the backend can change its clock (`ENCHW_HAS_BAUDRATE`).
+ * */
+uint32_t enc_spi_calibrate(enc_device_t *dev, uint32_t max_hz)
+{
+	uint32_t initial = enchw_get_baudrate(HWDEV);
+	uint32_t good = initial, request = initial, rate;
+	deadline_t deadline;
 
-	enc_BFS(ENC_ECON1, ENC_ECON1_CSUMEN | ENC_ECON1_DMAST);
+	if (max_hz > ENC_SPI_MAX_HZ)
+		max_hz = ENC_SPI_MAX_HZ;
 
-	while (enc_RCR(ENC_ECON1) & ENC_ECON1_DMAST) DEBUG(".");
+	if (spi_pattern_test(dev) != 0) {
+		enc_WCR16(dev, ENC_MAMXFLL, MAMXFL_DEFAULT);
+		return 0;
+	}
 
-	DEBUG("csum %08x", enc_RCR16(ENC_EDMACSL));
-	*/
+	while (request < max_hz) {
+		request += request / 4 + 1;
+		if (request > max_hz)
+			request = max_hz;
 
-	return 0;
+		rate = enchw_set_baudrate(HWDEV, request);
+		if (rate <= good) /* the backend can't do any better yet */
+			continue;
+		if (rate > max_hz)
+			break;
+		if (spi_pattern_test(dev) != 0) {
+			DEBUG("SPI fails at %lu Hz\n", (unsigned long)rate);
+			break;
+		}
+		good = rate;
+	}
+
+	rate = good / 100 * (100 - ENC_SPI_MARGIN);
+	if (rate < initial)
+		rate = initial;
+	rate = enchw_set_baudrate(HWDEV, rate);
+
+	/* a failed test may have left anything in any register */
+	enc_SRC(dev);
+	deadline_start(dev, &deadline, WAIT_SRC_US, WAIT_SRC_POLLS);
+	while (!deadline_passed(dev, &deadline))
+		enc_RCR(dev, ENC_ESTAT);
+	if (enc_wait(dev) != 0 || spi_pattern_test(dev) != 0 ||
+			enchw_get_baudrate(HWDEV) != rate) {
+		enchw_set_baudrate(HWDEV, initial);
+		rate = 0;
+	} else {
+		DEBUG("SPI works up to %lu Hz, using %lu Hz\n", (unsigned long)good, (unsigned long)rate);
+	}
+
+	enc_WCR16(dev, ENC_MAMXFLL, MAMXFL_DEFAULT);
+
+	return rate;
 }
+#endif
 
 static uint8_t command(enc_device_t *dev, uint8_t first, uint8_t second)
 {
+	enc_transfer_finish(dev);
+#ifdef ENCHW_HAS_BLOCKTRANSFER
+	uint8_t out[2] = {first, second};
+	uint8_t in[2];
+	enchw_select(HWDEV);
+	enchw_exchangeblock(HWDEV, out, in, 2);
+	enchw_unselect(HWDEV);
+	return in[1];
+#else
 	uint8_t result;
 	enchw_select(HWDEV);
 	enchw_exchangebyte(HWDEV, first);
 	result = enchw_exchangebyte(HWDEV, second);
 	enchw_unselect(HWDEV);
 	return result;
+#endif
+}
+
+/* Keep last_used_register in sync with what a command does to ECON1's BSEL
+ * bits. If only some bits are touched while the bank is unknown, it stays
+ * unknown. */
+static void track_bank(enc_device_t *dev, uint8_t op, uint8_t reg, uint8_t data)
+{
+	uint8_t bank;
+
+	if ((reg & ENC_REGISTERMASK) != (ENC_ECON1 & ENC_REGISTERMASK))
+		return;
+
+	data &= ENC_ECON1_BSEL;
+
+	if (dev->last_used_register == ENC_BANK_INDETERMINATE) {
+		if (op == 0x40)
+			bank = data;
+		else if (op == 0x80 && data == ENC_ECON1_BSEL)
+			bank = 3;
+		else if (op == 0xa0 && data == ENC_ECON1_BSEL)
+			bank = 0;
+		else
+			return;
+	} else {
+		bank = dev->last_used_register >> 6;
+		if (op == 0x40)
+			bank = data;
+		else if (op == 0x80)
+			bank |= data;
+		else
+			bank &= ~data;
+	}
+
+	dev->last_used_register = (bank << 6) | ENC_BANK0;
+}
+
+/* MAC and MII registers shift out a dummy byte before their value (4.2.1) */
+static int is_mac_mii_register(uint8_t reg)
+{
+	uint8_t address = reg & ENC_REGISTERMASK;
+
+	switch (reg & ENC_BANKMASK) {
+	case ENC_BANK2:
+		return 1;
+	case ENC_BANK3:
+		return address <= (ENC_MAADR2 & ENC_REGISTERMASK) || address == (ENC_MISTAT & ENC_REGISTERMASK);
+	default:
+		return 0;
+	}
+}
+
+static uint8_t read_mac_mii(enc_device_t *dev, uint8_t reg)
+{
+	enc_transfer_finish(dev);
+#ifdef ENCHW_HAS_BLOCKTRANSFER
+	uint8_t out[3] = {reg & ENC_REGISTERMASK, 0, 0};
+	uint8_t in[3];
+	enchw_select(HWDEV);
+	enchw_exchangeblock(HWDEV, out, in, 3);
+	enchw_unselect(HWDEV);
+	return in[2];
+#else
+	uint8_t result;
+	enchw_select(HWDEV);
+	enchw_exchangebyte(HWDEV, reg & ENC_REGISTERMASK);
+	enchw_exchangebyte(HWDEV, 0);
+	result = enchw_exchangebyte(HWDEV, 0);
+	enchw_unselect(HWDEV);
+	return result;
+#endif
+}
+
+/* Find the shadow copy of an 8-bit register, if there is one */
+static uint8_t *shadow_of(enc_device_t *dev, uint8_t reg, uint8_t *flag)
+{
+	switch (reg) {
+	case ENC_ERXFCON:
+		*flag = SHADOW_ERXFCON;
+		return &dev->shadow.erxfcon;
+	case ENC_MACON1:
+		*flag = SHADOW_MACON1;
+		return &dev->shadow.macon1;
+	case ENC_MACON3:
+		*flag = SHADOW_MACON3;
+		return &dev->shadow.macon3;
+	default:
+		return NULL;
+	}
+}
+
+/* Keep the shadow copies in sync with commands issued on their registers,
+ * no matter whether they come through WCR_shadowed or directly. The 16-bit
+ * ones are just invalidated; their setters validate them again. */
+static void track_shadow(enc_device_t *dev, uint8_t op, uint8_t reg, uint8_t data)
+{
+	uint8_t flag;
+	uint8_t *shadow;
+
+	switch (reg) {
+	case ENC_ETXSTL:
+	case ENC_ETXSTH:
+		dev->shadow.valid &= ~SHADOW_ETXST;
+		return;
+	case ENC_ERXNDL:
+	case ENC_ERXNDH:
+		dev->rxbufsize = ~0;
+		return;
+	}
+
+	shadow = shadow_of(dev, reg, &flag);
+	if (shadow == NULL)
+		return;
+
+	if (op == 0x40) {
+		*shadow = data;
+		dev->shadow.valid |= flag;
+	} else if (dev->shadow.valid & flag) {
+		if (op == 0x80)
+			*shadow |= data;
+		else
+			*shadow &= ~data;
+	}
+}
+
+/* Number of commands it takes to select a page without knowing the current
+ * one: setting the BSEL bits that should be 1 and clearing the others */
+static uint8_t blind_page_selection_cost(uint8_t page)
+{
+	return ((page & ENC_ECON1_BSEL) != 0) + ((~page & ENC_ECON1_BSEL) != 0);
 }
 
-/* this would recurse infinitely if ENC_ECON1 was not ENC_BANKALL */
+/* this would recurse infinitely if ENC_ECON1 was not ENC_BANKALL
+ *
+ * With a known current bank, only the BSEL bits that actually differ are
+ * touched, which takes a single BFS or BFC except for switches between banks 1
+ * and 2. (A single WCR would do for those too, but would clobber TXRTS and
+ * DMAST, which are cleared by the hardware and thus can't be shadowed.) */
 static void select_page(enc_device_t *dev, uint8_t page)
 {
-	uint8_t set = page & 0x03;
-	uint8_t clear = (~page) & 0x03;
+	uint8_t set, clear;
+
+	if (dev->last_used_register == ENC_BANK_INDETERMINATE) {
+		set = page & ENC_ECON1_BSEL;
+		clear = (~page) & ENC_ECON1_BSEL;
+	} else {
+		uint8_t current = dev->last_used_register >> 6;
+		set = page & ~current & ENC_ECON1_BSEL;
+		clear = current & ~page & ENC_ECON1_BSEL;
+	}
+
+	dev->bank_switches_saved += blind_page_selection_cost(page) - (set != 0) - (clear != 0);
+
 	if(set)
 		enc_BFS(dev, ENC_ECON1, set);
 	if(clear)
@@ -165,27 +621,65 @@ static void select_page(enc_device_t *dev, uint8_t page)
 static void ensure_register_accessible(enc_device_t *dev, enc_register_t r)
 {
 	if ((r & ENC_BANKMASK) == ENC_BANKALL) return;
-	if ((r & ENC_BANKMASK) == dev->last_used_register) return;
+	if ((r & ENC_BANKMASK) == dev->last_used_register) {
+		dev->bank_switches_saved += blind_page_selection_cost(r >> 6);
+		return;
+	}
 
 	select_page(dev, r >> 6);
 }
 
-/** @todo applies only to eth registers, not to mii ones */
 uint8_t enc_RCR(enc_device_t *dev, enc_register_t reg) {
 	ensure_register_accessible(dev, reg);
+	if (is_mac_mii_register(reg))
+		return read_mac_mii(dev, reg);
 	return command(dev, reg & ENC_REGISTERMASK, 0);
 }
 void enc_WCR(enc_device_t *dev, uint8_t reg, uint8_t data) {
 	ensure_register_accessible(dev, reg);
 	command(dev, 0x40 | (reg & ENC_REGISTERMASK), data);
+	track_bank(dev, 0x40, reg, data);
+	track_shadow(dev, 0x40, reg, data);
 }
 void enc_BFS(enc_device_t *dev, uint8_t reg, uint8_t data) {
 	ensure_register_accessible(dev, reg);
 	command(dev, 0x80 | (reg & ENC_REGISTERMASK), data);
+	track_bank(dev, 0x80, reg, data);
+	track_shadow(dev, 0x80, reg, data);
 }
 void enc_BFC(enc_device_t *dev, uint8_t reg, uint8_t data) {
 	ensure_register_accessible(dev, reg);
 	command(dev, 0xa0 | (reg & ENC_REGISTERMASK), data);
+	track_bank(dev, 0xa0, reg, data);
+	track_shadow(dev, 0xa0, reg, data);
+}
+
+/* Write a shadowed register unless it is known to have that value already.
+ * This is also the way to set bits in MAC registers, which don't support
+ * BFS/BFC. */
+static void WCR_shadowed(enc_device_t *dev, uint8_t reg, uint8_t data)
+{
+	uint8_t flag;
+	uint8_t *shadow = shadow_of(dev, reg, &flag);
+
+	if ((dev->shadow.valid & flag) && *shadow == data)
+		return;
+
+	enc_WCR(dev, reg, data);
+}
+
+/* Read a shadowed register, from the shadow copy if it is valid. */
+static uint8_t RCR_shadowed(enc_device_t *dev, uint8_t reg)
+{
+	uint8_t flag;
+	uint8_t *shadow = shadow_of(dev, reg, &flag);
+
+	if (!(dev->shadow.valid & flag)) {
+		*shadow = enc_RCR(dev, reg);
+		dev->shadow.valid |= flag;
+	}
+
+	return *shadow;
 }
 
 void enc_RBM(enc_device_t *dev, uint8_t *dest, uint16_t start, uint16_t length)
@@ -193,21 +687,77 @@ void enc_RBM(enc_device_t *dev, uint8_t *dest, uint16_t start, uint16_t length)
 	if (start != ENC_READLOCATION_ANY)
 		enc_WCR16(dev, ENC_ERDPTL, start);
 
+	enc_transfer_finish(dev);
 	enchw_select(HWDEV);
 	enchw_exchangebyte(HWDEV, 0x3a);
+#ifdef ENCHW_HAS_BLOCKTRANSFER
+	enchw_readblock(HWDEV, dest, length);
+#else
 	while(length--)
 		*(dest++) = enchw_exchangebyte(HWDEV, 0);
+#endif
+	enchw_unselect(HWDEV);
+}
+
+/** Start reading buffer memory like enc_RBM, but return while the transfer
+ * is still running if the backend can do that (`ENCHW_HAS_ASYNC_BLOCKTRANSFER`).
+ *
+ * `dest` must stay valid until @ref enc_transfer_busy returns 0. Any other
+ * access to the device implicitly waits for the transfer to finish (see @ref
+ * enc_transfer_finish). Without backend support, this is just enc_RBM. */
+void enc_RBM_start(enc_device_t *dev, uint8_t *dest, uint16_t start, uint16_t length)
+{
+#ifdef ENCHW_HAS_ASYNC_BLOCKTRANSFER
+	if (start != ENC_READLOCATION_ANY)
+		enc_WCR16(dev, ENC_ERDPTL, start);
+
+	enc_transfer_finish(dev);
+	enchw_select(HWDEV);
+	enchw_exchangebyte(HWDEV, 0x3a);
+	enchw_readblock_start(HWDEV, dest, length);
+	dev->transfer_pending = 1;
+#else
+	enc_RBM(dev, dest, start, length);
+#endif
+}
+
+/** Returns non-zero while a transfer started by @ref enc_RBM_start is still
+ * running. */
+int enc_transfer_busy(enc_device_t *dev)
+{
+#ifdef ENCHW_HAS_ASYNC_BLOCKTRANSFER
+	return dev->transfer_pending && enchw_block_busy(HWDEV);
+#else
+	(void)dev;
+	return 0;
+#endif
+}
+
+/** Wait for a transfer started by @ref enc_RBM_start to complete and release
+ * the bus. Does nothing if no transfer is pending. */
+void enc_transfer_finish(enc_device_t *dev)
+{
+	if (!dev->transfer_pending)
+		return;
+
+#ifdef ENCHW_HAS_ASYNC_BLOCKTRANSFER
+	enchw_block_wait(HWDEV);
 	enchw_unselect(HWDEV);
+#endif
+	dev->transfer_pending = 0;
 }
 
 static void WBM_raw(enc_device_t *dev, uint8_t *src, uint16_t length)
 {
+	enc_transfer_finish(dev);
 	enchw_select(HWDEV);
 	enchw_exchangebyte(HWDEV, 0x7a);
+#ifdef ENCHW_HAS_BLOCKTRANSFER
+	enchw_writeblock(HWDEV, src, length);
+#else
 	while(length--)
 		enchw_exchangebyte(HWDEV, *(src++));
-	enchw_unselect(HWDEV);
-	/** @todo this is actually just triggering another pause */
+#endif
 	enchw_unselect(HWDEV);
 }
 
@@ -234,79 +784,225 @@ void enc_WCR16(enc_device_t *dev, uint8_t reg, uint16_t data) {
 }
 
 void enc_SRC(enc_device_t *dev) {
+	enc_transfer_finish(dev);
+	enchw_select(HWDEV);
 	enchw_exchangebyte(HWDEV, 0xff);
+	enchw_unselect(HWDEV);
+
+	invalidate_cache(dev);
 }
 
 /** Wait for the ENC28J60 clock to be ready. Returns 0 on success,
  * and an unspecified non-zero integer on timeout. */
 int enc_wait(enc_device_t *dev)
 {
-	/** @todo as soon as we need a clock somewhere else, make this time and
-	 * not iteration based */
-
 	/** It has been observed that during power-up, MISO reads 1
 	 * continuously for some time, typically the time of 3 readouts; most
 	 * times, this gives 0xff, but occasionally starts with 0x1f or 0x03 or
-	 * even the expected (CLKRDY) value of 0x01. Requiring a much larger
-	 * number of consecutive identical reads to compensate for faster SPI
-	 * configurations. */
-	const int stable_required = 100;
-
-	int stable = 0;
+	 * even the expected (CLKRDY) value of 0x01. ESTAT is therefore
+	 * required to read the same for WAIT_STABLE_US (without a clock, for a
+	 * much larger number of consecutive reads, to compensate for faster SPI
+	 * configurations). */
+	deadline_t deadline, stable;
 	uint8_t estat, estat_last = 0;
-	for (int i = 0; i < 100000; ++i) {
+
+	deadline_start(dev, &deadline, WAIT_CLKRDY_US, WAIT_CLKRDY_POLLS);
+	deadline_start(dev, &stable, WAIT_STABLE_US, WAIT_STABLE_POLLS);
+	while (!deadline_passed(dev, &deadline)) {
 		estat = enc_RCR(dev, ENC_ESTAT);
 		if (estat != 0)
-			DEBUG("At %d, ESTAT is %02x\n", i, estat);
+			DEBUG("ESTAT is %02x\n", estat);
 		if (estat == 0xff) /* sometimes happens right at startup */
 			continue;
 
-		if (estat == estat_last) stable++;
+		if (estat != estat_last)
+			deadline_start(dev, &stable, WAIT_STABLE_US, WAIT_STABLE_POLLS);
 		estat_last = estat;
 
-		if (stable >= stable_required && estat & ENC_ESTAT_CLKRDY)
+		if (deadline_passed(dev, &stable) && estat & ENC_ESTAT_CLKRDY)
 			return 0;
 	}
 	return 1;
 }
 
+/* MII scanning has to be stopped for any other MII operation (3.3.3) */
+static void mii_scan_pause(enc_device_t *dev)
+{
+	if (dev->mii_scan == MII_SCAN_OFF)
+		return;
+
+	enc_WCR(dev, ENC_MICMD, 0);
+	wait_clear(dev, ENC_MISTAT, ENC_MISTAT_BUSY, WAIT_MII_US, WAIT_MII_POLLS);
+}
+
+static void mii_scan_resume(enc_device_t *dev)
+{
+	if (dev->mii_scan == MII_SCAN_OFF)
+		return;
+
+	wait_clear(dev, ENC_MISTAT, ENC_MISTAT_BUSY, WAIT_MII_US, WAIT_MII_POLLS);
+	enc_WCR(dev, ENC_MIREGADR, ENC_PHSTAT2);
+	enc_WCR(dev, ENC_MICMD, ENC_MICMD_MIISCAN);
+	dev->mii_scan = MII_SCAN_RESTARTED;
+}
+
+/* MICMD is a MAC register, which can't be manipulated with BFS/BFC, and
+ * MIIRD and MIISCAN are its only bits, so it is always written as a whole. */
 uint16_t enc_MII_read(enc_device_t *dev, enc_register_t mireg)
 {
 	uint16_t result = 0;
 
+	mii_scan_pause(dev);
+
 	enc_WCR(dev, ENC_MIREGADR, mireg);
-	enc_BFS(dev, ENC_MICMD, ENC_MICMD_MIIRD);
+	enc_WCR(dev, ENC_MICMD, ENC_MICMD_MIIRD);
 
-	while(enc_RCR(dev, ENC_MISTAT) & ENC_MISTAT_BUSY);
+	wait_clear(dev, ENC_MISTAT, ENC_MISTAT_BUSY, WAIT_MII_US, WAIT_MII_POLLS);
 
 	result = enc_RCR16(dev, ENC_MIRDL);
 
-	enc_BFC(dev, ENC_MICMD, ENC_MICMD_MIIRD);
+	enc_WCR(dev, ENC_MICMD, 0);
+
+	mii_scan_resume(dev);
 
 	return result;
 }
 
 void enc_MII_write(enc_device_t *dev, uint8_t mireg, uint16_t data)
 {
-	while(enc_RCR(dev, ENC_MISTAT) & ENC_MISTAT_BUSY);
+	mii_scan_pause(dev);
+
+	wait_clear(dev, ENC_MISTAT, ENC_MISTAT_BUSY, WAIT_MII_US, WAIT_MII_POLLS);
 
 	enc_WCR(dev, ENC_MIREGADR, mireg);
 	enc_WCR16(dev, ENC_MIWRL, data);
+
+	if (mireg == ENC_PHLCON) {
+		dev->shadow.phlcon = data;
+		dev->shadow.valid |= SHADOW_PHLCON;
+	}
+
+	mii_scan_resume(dev);
+}
+
+/** Make the chip continuously read PHSTAT2 into MIRD, so @ref enc_link_state
+ * can be answered by reading a single register instead of a full MII read.
+ *
+ * Other MII operations stop the scan temporarily. */
+void enc_link_monitor_start(enc_device_t *dev)
+{
+	if (dev->mii_scan != MII_SCAN_OFF)
+		return;
+
+	/* abusing resume to start */
+	dev->mii_scan = MII_SCAN_RUNNING;
+	mii_scan_resume(dev);
+}
+
+/* Read PHSTAT2, or just the high byte from the MII scan if it is running
+ * (which is all the status bits used here) */
+static uint16_t read_phstat2(enc_device_t *dev)
+{
+	if (dev->mii_scan == MII_SCAN_OFF)
+		return enc_MII_read(dev, ENC_PHSTAT2);
+
+	/* right after (re)starting, MIRD still holds whatever was read last */
+	if (dev->mii_scan == MII_SCAN_RESTARTED) {
+		wait_clear(dev, ENC_MISTAT, ENC_MISTAT_NVALID, WAIT_MII_US, WAIT_MII_POLLS);
+		dev->mii_scan = MII_SCAN_RUNNING;
+	}
+
+	return enc_RCR(dev, ENC_MIRDH) << 8;
+}
+
+/** Returns non-zero if the link is up. */
+int enc_link_state(enc_device_t *dev)
+{
+	return (read_phstat2(dev) & ENC_PHSTAT2_LSTAT) != 0;
 }
 
+/** Returns the duplex mode the PHY operates in (ENC_DUPLEX_HALF or
+ * ENC_DUPLEX_FULL). */
+int enc_duplex(enc_device_t *dev)
+{
+	return (read_phstat2(dev) & ENC_PHSTAT2_DPXSTAT) ? ENC_DUPLEX_FULL : ENC_DUPLEX_HALF;
+}
 
 void enc_LED_set(enc_device_t *dev, enc_lcfg_t ledconfig, enc_led_t led)
 {
 	uint16_t state;
-	state = enc_MII_read(dev, ENC_PHLCON);
-	state = (state & ~(ENC_LCFG_MASK << led)) | (ledconfig << led);
-	enc_MII_write(dev, ENC_PHLCON, state);
+
+	if (!(dev->shadow.valid & SHADOW_PHLCON)) {
+		dev->shadow.phlcon = enc_MII_read(dev, ENC_PHLCON);
+		dev->shadow.valid |= SHADOW_PHLCON;
+	}
+
+	state = (dev->shadow.phlcon & ~(ENC_LCFG_MASK << led)) | (ledconfig << led);
+	if (state != dev->shadow.phlcon)
+		enc_MII_write(dev, ENC_PHLCON, state);
+}
+
+/** Configure which events pull the INT pin low, as a combination of
+ * ENC_EIE_* flags (ENC_EIE_INTIE is added automatically unless eie is 0).
+ *
+ * If ENC_EIE_LINKIE is requested, the PHY is configured to report link
+ * changes as well. */
+void enc_interrupts_setup(enc_device_t *dev, uint8_t eie)
+{
+	if (eie & ENC_EIE_LINKIE)
+		enc_MII_write(dev, ENC_PHIE, ENC_PHIE_PGEIE | ENC_PHIE_PLNKIE);
+	else
+		enc_MII_write(dev, ENC_PHIE, 0);
+
+	if (eie)
+		eie |= ENC_EIE_INTIE;
+
+	enc_WCR(dev, ENC_EIE, eie);
+}
+
+/** Returns non-zero if the INT line is asserted, or if that can't be told
+ * because the backend has no access to it (no `ENCHW_HAS_INTERRUPT`).
+ *
+ * This does not access the SPI bus and is thus cheap enough to decide
+ * whether a poll is worth doing. */
+int enc_interrupt_pending(enc_device_t *dev)
+{
+#ifdef ENCHW_HAS_INTERRUPT
+	return enchw_interrupt_pending(HWDEV);
+#else
+	(void)dev;
+	return 1;
+#endif
+}
+
+/** Read the pending interrupt flags (EIR) */
+uint8_t enc_interrupt_flags(enc_device_t *dev)
+{
+	return enc_RCR(dev, ENC_EIR);
+}
+
+/** Acknowledge interrupt flags as read by @ref enc_interrupt_flags.
+ *
+ * ENC_EIR_LINKIF is cleared by reading PHIR. ENC_EIR_PKTIF can't be cleared;
+ * it only goes away when all frames are received. */
+void enc_interrupt_clear(enc_device_t *dev, uint8_t eir)
+{
+	if (eir & ENC_EIR_LINKIF)
+		enc_MII_read(dev, ENC_PHIR);
+
+	eir &= ENC_EIR_RXERIF | ENC_EIR_TXERIF | ENC_EIR_TXIF | ENC_EIR_DMAIF;
+	if (eir)
+		enc_BFC(dev, ENC_EIR, eir);
 }
 
+static void transmit_setup(enc_device_t *dev);
+
 /** Configure the ENC28J60 for network operation, whose initial parameters get
- * passed as well. */
+ * passed as well. The duplex mode is taken from the device's duplex_setting. */
 void enc_ethernet_setup(enc_device_t *dev, uint16_t rxbufsize, uint8_t mac[6])
 {
+	int full_duplex = dev->duplex_setting == ENC_DUPLEX_FULL;
+
 	/* practical consideration: we don't come out of clean reset, better do
 	 * this -- discard all previous packages */
 
@@ -325,29 +1021,42 @@ void enc_ethernet_setup(enc_device_t *dev, uint16_t rxbufsize, uint8_t mac[6])
 
 	dev->next_frame_location = 0;
 
+	transmit_setup(dev);
+
 	/******** for the moment, the receive filters are good as they are (6.3) ******/
 
 	/******** waiting for ost (6.4) already happened in _setup ******/
 
 	/******** mac initialization acording to 6.5 ************/
 
-	/* enable reception and flow control (shouldn't hurt in simplex either) */
-	enc_BFS(dev, ENC_MACON1, ENC_MACON1_MARXEN | ENC_MACON1_TXPAUS | ENC_MACON1_RXPAUS);
+	/* enable reception and flow control (shouldn't hurt in simplex either);
+	 * written as a whole because BFS does not work on MAC registers, and
+	 * MACON1 comes out of reset as zero */
+	WCR_shadowed(dev, ENC_MACON1, ENC_MACON1_MARXEN | ENC_MACON1_TXPAUS | ENC_MACON1_RXPAUS);
 
-	/* generate checksums for outgoing frames and manage padding automatically */
-	enc_WCR(dev, ENC_MACON3, ENC_MACON3_TXCRCEN | ENC_MACON3_FULLPADDING | ENC_MACON3_FRMLEN);
+	/* generate checksums for outgoing frames and manage padding
+	 * automatically; duplex has to match the PHY's (set below) */
+	WCR_shadowed(dev, ENC_MACON3, ENC_MACON3_TXCRCEN | ENC_MACON3_FULLPADDING | ENC_MACON3_FRMLEN |
+			(full_duplex ? ENC_MACON3_FULDPX : 0));
 
-	/* setting defer is mandatory for 802.3, but it seems the default is reasonable too */
+	/* setting defer is mandatory for 802.3 in half duplex: wait for the
+	 * medium indefinitely rather than aborting excessively deferred
+	 * frames; it is meaningless in full duplex */
+	enc_WCR(dev, ENC_MACON4, full_duplex ? 0 : ENC_MACON4_DEFER);
 
 	/* MAMXF has reasonable default */
 
-	/* it's not documented in detail what these do, just how to program them */
+	/* it's not documented in detail what these do, just how to program them
+	 * (MAIPGH is only used in half duplex) */
+	enc_WCR(dev, ENC_MABBIPG, full_duplex ? 0x15 : 0x12);
 	enc_WCR(dev, ENC_MAIPGL, 0x12);
-	enc_WCR(dev, ENC_MAIPGH, 0x0C);
+	if (!full_duplex)
+		enc_WCR(dev, ENC_MAIPGH, 0x0C);
 
 	/* MACLCON registers have reasonable defaults */
 
 	/* set the mac address */
+	memcpy(dev->mac, mac, 6);
 	enc_WCR(dev, ENC_MAADR1, mac[0]);
 	enc_WCR(dev, ENC_MAADR2, mac[1]);
 	enc_WCR(dev, ENC_MAADR3, mac[2]);
@@ -357,11 +1066,15 @@ void enc_ethernet_setup(enc_device_t *dev, uint16_t rxbufsize, uint8_t mac[6])
 
 	/******* mac initialization as per 6.5 ********/
 
+	/* out of reset, the PHY's duplex mode follows the LEDB polarity; make
+	 * it match the MAC's */
+	enc_MII_write(dev, ENC_PHCON1, full_duplex ? ENC_PHCON1_PDPXMD : 0);
+
 	/* filter out looped packages; otherwise our own ND6 packages are
 	 * treated as DAD failures. (i can't think of a reason why one would
-	 * not want that; let me know if there is and it culd become configurable) */
-	/* set ENC_PHCON2 bit 8 (HDLDIS) */
-	enc_MII_write(dev, ENC_PHCON1, 0x0100);
+	 * not want that; let me know if there is and it culd become configurable)
+	 * Only matters in half duplex. */
+	enc_MII_write(dev, ENC_PHCON2, ENC_PHCON2_HDLDIS);
 
 	/*************** enabling reception as per 7.2 ***********/
 
@@ -372,119 +1085,687 @@ void enc_ethernet_setup(enc_device_t *dev, uint16_t rxbufsize, uint8_t mac[6])
 	enc_BFC(dev, ENC_ECON1, ENC_ECON1_TXRST | ENC_ECON1_RXRST);
 }
 
-/** Configure whether multicasts should be received.
+/** Move the boundary between the receive buffer and the transmit slots:
+ * rxbufsize is the new last address of the receive buffer, as in @ref
+ * enc_ethernet_setup, but the rest has to hold at least one full sized
+ * frame.
  *
- * The more cmplex hash table mechanism that would allow filtering for
- * particular groups is not exposed yet. */
-void enc_set_multicast_reception(enc_device_t *dev, int enable)
+ * This can only happen while no frames are queued in either direction;
+ * reception is paused meanwhile, so frames arriving at that moment are lost.
+ * Returns 0 on success, or an unspecified error code if the size is not
+ * acceptable or the driver is not idle (nothing is changed then, try again
+ * later). */
+int enc_rx_buffer_resize(enc_device_t *dev, uint16_t rxbufsize)
 {
-	if (enable)
-		enc_BFS(dev, ENC_ERXFCON, 0x2);
-	else
-		enc_BFC(dev, ENC_ERXFCON, 0x2);
-}
+	if (rxbufsize > ENC_RXBUFSIZE_MAX)
+		return 1;
 
-static uint16_t transmit_start_address(enc_device_t *dev)
-{
-	uint16_t earliest_start = dev->rxbufsize + 1; /* +1 because it's not actually the size but the last byte */
+	if (rxbufsize == get_erxnd(dev))
+		return 0;
 
-	/* It is recommended that an even address be used for ETXST. */
-	return (earliest_start + 1) & ~1;
-}
+#ifdef ENC28J60_USE_PBUF
+	if (dev->rx_pending != NULL)
+		return 2;
+#endif
+	if (dev->tx.queued != 0 || enc_RCR(dev, ENC_EPKTCNT) != 0)
+		return 2;
+
+	/* the buffer pointers may only be changed while reception is off
+	 * (6.1); a frame that is being received gets finished first */
+	enc_BFC(dev, ENC_ECON1, ENC_ECON1_RXEN);
+	if (wait_clear(dev, ENC_ESTAT, ENC_ESTAT_RXBUSY, WAIT_RXBUSY_US, WAIT_RXBUSY_POLLS) != 0 ||
+			enc_RCR(dev, ENC_EPKTCNT) != 0) {
+		enc_BFS(dev, ENC_ECON1, ENC_ECON1_RXEN);
+		return 2;
+	}
 
-/* Partial function of enc_transmit. Always call this as transmit_start /
- * {transmit_partial * n} / transmit_end -- and use enc_transmit or
- * enc_transmit_pbuf unless you're just implementing those two */
-void transmit_start(enc_device_t *dev)
-{
-	/* according to section 7.1 */
-	uint8_t control_byte = 0; /* no overrides */
+	/* writing ERXST resets ERXWRPT to it, so the buffer starts out empty */
+	enc_WCR16(dev, ENC_ERXSTL, 0); /* see errata, must be 0 */
+	set_erxnd(dev, rxbufsize);
+	dev->next_frame_location = 0;
+	/* as receive_end would do for next_frame_location 0 (errata #14) */
+	enc_WCR16(dev, ENC_ERXRDPTL, dev->rxbufsize);
 
-	/* 1. */
-	/** @todo we only send a single frame blockingly, starting at the end of rxbuf */
-	enc_WCR16(dev, ENC_ETXSTL, transmit_start_address(dev));
-	/* 2. */
-	enc_WBM(dev, &control_byte, transmit_start_address(dev), 1);
+	transmit_setup(dev);
+
+	enc_BFS(dev, ENC_ECON1, ENC_ECON1_RXEN);
+
+	return 0;
 }
 
-void transmit_partial(enc_device_t *dev, uint8_t *data, uint16_t length)
+/** Hold off the link partner while the receive buffer is filled beyond
+ * flow_high percent, until it drained below flow_low percent: In full
+ * duplex, pause frames are sent (repeatedly, and a zero pause frame to
+ * release); in half duplex, backpressure is applied by jamming the medium.
+ *
+ * The fill level is ERXWRPT's distance from the next frame to be read. This
+ * should be called after reading frames; it does nothing unless flow_high is
+ * set. flow_high is limited to 100, and flow_low to below flow_high. Returns
+ * non-zero while flow control is active. */
+int enc_flow_control_poll(enc_device_t *dev)
 {
-	WBM_raw(dev, data, length);
+	uint32_t size = get_erxnd(dev) + 1;
+	uint16_t write;
+	uint32_t used;
+	int full_duplex;
+	/* inconsistent watermarks would toggle flow control on every poll */
+	uint8_t high = dev->flow_high > 100 ? 100 : dev->flow_high;
+	uint8_t low = dev->flow_low < high ? dev->flow_low : high - 1;
+
+	if (high == 0 && !dev->flow_active)
+		return 0;
+
+	write = enc_RCR16(dev, ENC_ERXWRPTL);
+	if (write >= dev->next_frame_location)
+		used = write - dev->next_frame_location;
+	else
+		used = size - (dev->next_frame_location - write);
+
+	full_duplex = (RCR_shadowed(dev, ENC_MACON3) & ENC_MACON3_FULDPX) != 0;
+
+	if (!dev->flow_active && high != 0 && used * 100 >= high * size) {
+		enc_WCR(dev, ENC_EFLOCON, full_duplex ? ENC_EFLOCON_FCEN1 : ENC_EFLOCON_FCEN0);
+		dev->flow_active = 1;
+	} else if (dev->flow_active && (high == 0 || used * 100 <= low * size)) {
+		/* FCEN 11 sends a zero pause frame and falls back to 00 */
+		enc_WCR(dev, ENC_EFLOCON, full_duplex ? ENC_EFLOCON_FCEN1 | ENC_EFLOCON_FCEN0 : 0);
+		dev->flow_active = 0;
+	}
+
+	return dev->flow_active;
 }
 
-void transmit_end(enc_device_t *dev, uint16_t length)
+/** Receive filters that stay enabled with @ref enc_wake_filters_only */
+#define WAKE_FILTERS (ENC_ERXFCON_PMEN | ENC_ERXFCON_MPEN)
+
+/* Clear and set receive filter bits in ERXFCON. While only the wake filters
+ * are active, changes to the other filters go to erxfcon_awake, and take
+ * effect when enc_wake_filters_only is left. */
+static void update_erxfcon(enc_device_t *dev, uint8_t clear, uint8_t set)
 {
-	uint8_t result[7];
+	if (dev->wake_filters_only) {
+		dev->erxfcon_awake = (dev->erxfcon_awake & ~clear) | set;
+		clear &= WAKE_FILTERS;
+		set &= WAKE_FILTERS;
+	}
+	WCR_shadowed(dev, ENC_ERXFCON, (RCR_shadowed(dev, ENC_ERXFCON) & ~clear) | set);
+}
 
-	/* calculate checksum */
+/** Configure whether multicasts should be received.
+ *
+ * The more cmplex hash table mechanism that would allow filtering for
+ * particular groups is not exposed yet. */
+void enc_set_multicast_reception(enc_device_t *dev, int enable)
+{
+	update_erxfcon(dev, ENC_ERXFCON_MCEN, enable ? ENC_ERXFCON_MCEN : 0);
+}
 
-//	enc_WCR16(dev, ENC_EDMASTL, start + 1);
-//	enc_WCR16(dev, ENC_EDMANDL, start + 1 + length - 3);
-//	enc_BFS(dev, ENC_ECON1, ENC_ECON1_CSUMEN | ENC_ECON1_DMAST);
-//	while (enc_RCR(dev, ENC_ECON1) & ENC_ECON1_DMAST);
-//	uint16_t checksum = enc_RCR16(dev, ENC_EDMACSL);
-//	checksum = ((checksum & 0xff) << 8) | (checksum >> 8);
-//	enc_WBM(dev, &checksum, start + 1 + length - 2, 2);
+/* Index into the hash table filter for a destination address: bits 28:23 of
+ * the frame check sequence over the address (8.3) -- the CRC-32 as it is
+ * shifted through the MAC, without final inversion. */
+static uint8_t multicast_hash(const uint8_t mac[6])
+{
+	uint32_t crc = 0xffffffff;
+
+	for (int i = 0; i < 6; ++i) {
+		uint8_t octet = mac[i];
+		for (int bit = 0; bit < 8; ++bit, octet >>= 1)
+			crc = (crc << 1) ^ (((crc >> 31) ^ (octet & 1)) ? 0x04c11db7 : 0);
+	}
+
+	return (crc >> 23) & 0x3f;
+}
+
+/** Receive frames to the multicast address mac. Addresses are reference
+ * counted, so every group can be added once for each user and needs to be
+ * removed as often with @ref enc_multicast_remove.
+ *
+ * This enables the hash table filter, which passes all frames whose
+ * destination hashes to any of the added addresses; it has no effect while
+ * multicast reception is enabled altogether (@ref
+ * enc_set_multicast_reception). Returns 0 on success, or an unspecified error
+ * code if the address was added too often. */
+int enc_multicast_add(enc_device_t *dev, const uint8_t mac[6])
+{
+	uint8_t hash = multicast_hash(mac);
+
+	if (dev->multicast_refs[hash] == 0xff)
+		return 1;
+
+	if (dev->multicast_refs[hash]++ == 0)
+		enc_BFS(dev, ENC_EHT0 + (hash >> 3), 1 << (hash & 7));
+
+	update_erxfcon(dev, 0, ENC_ERXFCON_HTEN);
+
+	return 0;
+}
+
+/** Stop receiving frames to the multicast address mac, once all users that
+ * added it have removed it. Returns 0 on success, or an unspecified error code
+ * if the address was not added. */
+int enc_multicast_remove(enc_device_t *dev, const uint8_t mac[6])
+{
+	uint8_t hash = multicast_hash(mac);
+
+	if (dev->multicast_refs[hash] == 0)
+		return 1;
+
+	if (--dev->multicast_refs[hash] == 0)
+		enc_BFC(dev, ENC_EHT0 + (hash >> 3), 1 << (hash & 7));
+
+	return 0;
+}
+
+/** Set up the pattern match filter (8.2) and enable it: frames are accepted
+ * if the bytes selected by mask in the ENC_PATTERN_SIZE bytes starting at
+ * offset into the frame (counted from the destination address) equal those in
+ * pattern. Bit n of mask[i] selects byte 8*i+n.
+ *
+ * The chip only compares a checksum over the selected bytes, so rare false
+ * positives have to be expected. */
+void enc_pattern_match_set(enc_device_t *dev, uint16_t offset, const uint8_t pattern[ENC_PATTERN_SIZE], const uint8_t mask[ENC_PATTERN_SIZE / 8])
+{
+	uint32_t sum = 0;
+	uint8_t odd = 0;
+
+	/* the selected bytes form a stream of big-endian 16-bit words, summed
+	 * up like the IP checksum */
+	for (int i = 0; i < ENC_PATTERN_SIZE; ++i) {
+		if (!(mask[i >> 3] & (1 << (i & 7))))
+			continue;
+		sum += odd ? pattern[i] : pattern[i] << 8;
+		odd = !odd;
+	}
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+	sum = ~sum & 0xffff;
+
+	for (int i = 0; i < ENC_PATTERN_SIZE / 8; ++i)
+		enc_WCR(dev, ENC_EPMM0 + i, mask[i]);
+	enc_WCR16(dev, ENC_EPMCSL, sum);
+	enc_WCR16(dev, ENC_EPMOL, offset);
+
+	update_erxfcon(dev, 0, ENC_ERXFCON_PMEN);
+}
+
+/** Stop accepting frames because of the pattern match filter */
+void enc_pattern_match_disable(enc_device_t *dev)
+{
+	update_erxfcon(dev, ENC_ERXFCON_PMEN, 0);
+}
+
+/** Enable or disable the magic packet filter, which accepts Wake-on-LAN frames
+ * to the configured MAC address */
+void enc_magic_packet_set(enc_device_t *dev, int enable)
+{
+	update_erxfcon(dev, ENC_ERXFCON_MPEN, enable ? ENC_ERXFCON_MPEN : 0);
+}
+
+/** Restrict reception to frames that pass the pattern match or magic packet
+ * filter, or return to the previous filter setup if enable is 0.
+ *
+ * Together with the INT line (ENC_EIE_PKTIE), this lets the MCU sleep until
+ * a frame it is interested in arrives, instead of being woken by every
+ * broadcast. */
+void enc_wake_filters_only(enc_device_t *dev, int enable)
+{
+	uint8_t erxfcon = RCR_shadowed(dev, ENC_ERXFCON);
+
+	if (!enable == !dev->wake_filters_only)
+		return;
+
+	if (enable) {
+		dev->erxfcon_awake = erxfcon;
+		/* this also leaves AND mode, in which frames would have to
+		 * pass all filters */
+		erxfcon &= WAKE_FILTERS | ENC_ERXFCON_CRCEN;
+	} else {
+		/* the wake filters may have been changed in the meantime */
+		erxfcon = (dev->erxfcon_awake & ~WAKE_FILTERS) | (erxfcon & WAKE_FILTERS);
+	}
+	dev->wake_filters_only = enable != 0;
+
+	WCR_shadowed(dev, ENC_ERXFCON, erxfcon);
+}
+
+static uint16_t transmit_start_address(enc_device_t *dev)
+{
+	uint16_t earliest_start = get_erxnd(dev) + 1; /* +1 because it's not actually the size but the last byte */
+
+	/* It is recommended that an even address be used for ETXST. */
+	return (earliest_start + 1) & ~1;
+}
+
+static uint16_t transmit_slot_address(enc_device_t *dev, uint8_t slot)
+{
+	return transmit_start_address(dev) + slot * dev->tx.slotsize;
+}
+
+/* Split the memory above the receive buffer into transmit slots. If there is
+ * not even room for a full sized frame, a single smaller slot is used. */
+static void transmit_setup(enc_device_t *dev)
+{
+	uint16_t space = ENC_RAMSIZE - transmit_start_address(dev);
+
+	dev->tx.count = space / ENC_TX_SLOT_SIZE;
+	if (dev->tx.count > ENC_TX_SLOTS)
+		dev->tx.count = ENC_TX_SLOTS;
+
+	if (dev->tx.count == 0) {
+		dev->tx.count = 1;
+		dev->tx.slotsize = space;
+	} else {
+		dev->tx.slotsize = (ENC_TX_SLOT_SIZE + 1) & ~1;
+	}
+
+	dev->tx.head = 0;
+	dev->tx.tail = 0;
+	dev->tx.queued = 0;
+	dev->tx.active = 0;
+}
+
+/* Send the frame at the ring's tail */
+static void transmit_send(enc_device_t *dev)
+{
+	uint16_t start = transmit_slot_address(dev, dev->tx.tail);
+
+	/* 7.1 step 1 and 3 */
+	set_etxst(dev, start);
+	enc_WCR16(dev, ENC_ETXNDL, start + 1 + dev->tx.length[dev->tx.tail] - 1);
 
-	/* 3. */
-	enc_WCR16(dev, ENC_ETXNDL, transmit_start_address(dev) + 1 + length - 1);
-	
 	/* 4. */
-	/* skipped because not using interrupts yet */
+	/* TXIF is cleared by the interrupt handling if it is used */
 	/* 5. */
 	enc_BFS(dev, ENC_ECON1, ENC_ECON1_TXRTS);
 
-	/* block */
-	for (int i = 0; i < 10000; ++i) {
-		if (!(enc_RCR(dev, ENC_ECON1) & ENC_ECON1_TXRTS))
-			goto done;
-	}
-	/* Workaround for 80349c.pdf (errata) #12 and #13: Reset the
-	 * transmission logic after an arbitrary timeout.
-	 *
-	 * This is not a particularly good workaround, neither in terms of
-	 * networking behavior (no retransmission is attempted as suggested for
-	 * #13) nor in terms of driver (just blocking for some time that is
-	 * hopefully long enough but not too long to bother the watchdog), but
-	 * it should work.
-	 * */
-	DEBUG("Econ1 TXRTS did not clear; resetting transmission logic.\n");
+	if (dev->clock != NULL)
+		dev->tx.deadline = dev->clock() + clock_ticks(dev, ENC_TX_TIMEOUT_US);
+	dev->tx.active = 1;
+}
+
+/* Hand the oldest queued frame to the transmitter if it is idle */
+static void transmit_kick(enc_device_t *dev)
+{
+	if (dev->tx.active || dev->tx.queued == 0)
+		return;
+
+	dev->tx.retries = 0;
+	transmit_send(dev);
+}
+
+/* Pulse TXRST, which gets the transmit logic out of the stalled state of
+ * 80349c.pdf (errata) #12, and clear the flags of the last transmission */
+static void transmit_reset(enc_device_t *dev)
+{
 	enc_BFS(dev, ENC_ECON1, ENC_ECON1_TXRST);
 	enc_BFC(dev, ENC_ECON1, ENC_ECON1_TXRST);
+	enc_BFC(dev, ENC_ESTAT, ENC_ESTAT_TXABRT);
+	enc_BFC(dev, ENC_EIR, ENC_EIR_TXERIF);
+}
 
-	return;
-done:
-	enc_RBM(dev, result, transmit_start_address(dev) + length, 7);
-	DEBUG("transmitted. %02x %02x %02x %02x %02x %02x %02x\n", result[0], result[1], result[2], result[3], result[4], result[5], result[6]);
+/* Decode the transmit status vector (7.1, table 7-1) */
+static void transmit_decode_status(const uint8_t tsv[7], enc_tx_status_t *status)
+{
+	status->length = tsv[0] | (tsv[1] << 8);
+	status->flags = tsv[2] | (tsv[3] << 8);
+	status->wire_length = tsv[4] | (tsv[5] << 8);
+
+	if (status->flags & ENC_TSV_DONE)
+		status->result = ENC_TX_OK;
+	else if (status->flags & ENC_TSV_LATECOLLISION)
+		status->result = ENC_TX_LATECOLLISION;
+	else if (status->flags & ENC_TSV_EXCESSIVECOLLISION)
+		status->result = ENC_TX_EXCESSIVECOLLISION;
+	else if (status->flags & ENC_TSV_EXCESSIVEDEFER)
+		status->result = ENC_TX_EXCESSIVEDEFER;
+	else
+		status->result = ENC_TX_ABORTED;
+}
 
-	/** @todo parse that and return reasonable state */
+static void transmit_count(enc_device_t *dev, const enc_tx_status_t *status)
+{
+	switch (status->result) {
+	case ENC_TX_OK:
+		dev->txstats.frames++;
+		dev->txstats.bytes += status->wire_length;
+		dev->txstats.collisions += status->flags & ENC_TSV_COLLISIONCOUNT;
+		if (status->flags & ENC_TSV_DEFER)
+			dev->txstats.deferred++;
+		break;
+	case ENC_TX_LATECOLLISION:
+		dev->txstats.late_collisions++;
+		break;
+	case ENC_TX_EXCESSIVECOLLISION:
+		dev->txstats.excessive_collisions++;
+		break;
+	case ENC_TX_EXCESSIVEDEFER:
+		dev->txstats.excessive_defers++;
+		break;
+	case ENC_TX_ABORTED:
+		dev->txstats.aborted++;
+		break;
+	case ENC_TX_TIMEOUT:
+		dev->txstats.timeouts++;
+		break;
+	}
+
+	if (dev->tx_done != NULL)
+		dev->tx_done(dev->tx_done_arg, status);
 }
 
-void enc_transmit(enc_device_t *dev, uint8_t *data, uint16_t length)
+/* Retire the frame that was sent last, or send it again if it failed in a
+ * way that deserves a retry. If timeout is set, it did not finish and the
+ * transmit logic was reset. */
+static void transmit_complete(enc_device_t *dev, int timeout)
 {
-	/** @todo check buffer size */
-	transmit_start(dev);
+	enc_tx_status_t status;
+	uint8_t slot = dev->tx.tail;
+	uint8_t tsv[7];
+	uint8_t estat;
+
+	if (timeout) {
+		status.result = ENC_TX_TIMEOUT;
+		status.length = dev->tx.length[slot];
+		status.wire_length = 0;
+		status.flags = 0;
+	} else {
+		/* the status vector is written right after ETXND */
+		enc_RBM(dev, tsv, transmit_slot_address(dev, slot) + 1 + dev->tx.length[slot], 7);
+		transmit_decode_status(tsv, &status);
+
+		/* Workaround for 80349c.pdf (errata) #12: an aborted
+		 * transmission can stall the transmit logic, which has to be
+		 * reset before the next frame is sent. Late collisions are
+		 * not always in the status vector (#13). */
+		estat = enc_RCR(dev, ENC_ESTAT);
+		if (estat & (ENC_ESTAT_TXABRT | ENC_ESTAT_LATECOL)) {
+			transmit_reset(dev);
+			if (estat & ENC_ESTAT_LATECOL)
+				status.result = ENC_TX_LATECOLLISION;
+			else if (status.result == ENC_TX_OK)
+				status.result = ENC_TX_ABORTED;
+		}
+	}
+
+	/* As recommended for errata #13, frames lost to late collisions are
+	 * sent again, as are ones that broke otherwise; the frame is still in
+	 * its slot, only the transmission is restarted. Excessive collisions
+	 * and deferrals already went through the MAC's own retries. */
+	if ((status.result == ENC_TX_LATECOLLISION || status.result == ENC_TX_ABORTED ||
+			status.result == ENC_TX_TIMEOUT) && dev->tx.retries < ENC_TX_RETRIES) {
+		DEBUG("Retrying transmission (result %d).\n", status.result);
+		dev->tx.retries++;
+		dev->txstats.retries++;
+		transmit_send(dev);
+		return;
+	}
+
+	if (status.result == ENC_TX_OK && dev->tx.retries != 0)
+		dev->txstats.recovered++;
+
+	dev->tx.active = 0;
+	dev->tx.tail = (slot + 1) % dev->tx.count;
+	dev->tx.queued--;
+
+	transmit_count(dev, &status);
+}
+
+/* Workaround for 80349c.pdf (errata) #12 and #13: TXRTS did not clear in
+ * time, so the transmission logic is reset and the frame retried or
+ * dropped. */
+static void transmit_timeout(enc_device_t *dev)
+{
+	DEBUG("Econ1 TXRTS did not clear; resetting transmission logic.\n");
+	transmit_reset(dev);
+	transmit_complete(dev, 1);
+	transmit_kick(dev);
+}
+
+/** Check whether the frame being sent is done, and start sending the next
+ * queued one if so. Returns the number of frames that are still queued,
+ * including the one being sent.
+ *
+ * The outcome of finished frames is accounted in the device's txstats and
+ * reported to its tx_done callback.
+ *
+ * This only reads a register if a frame is being sent; it should be called
+ * regularly (or on ENC_EIR_TXIF / ENC_EIR_TXERIF) to keep the queue moving.
+ * */
+int enc_transmit_poll(enc_device_t *dev)
+{
+	if (dev->tx.active) {
+		if (enc_RCR(dev, ENC_ECON1) & ENC_ECON1_TXRTS) {
+			if (dev->clock != NULL && clock_passed(dev, dev->tx.deadline))
+				transmit_timeout(dev);
+			return dev->tx.queued;
+		}
+		transmit_complete(dev, 0);
+	}
+
+	transmit_kick(dev);
+
+	return dev->tx.queued;
+}
+
+/* Wait until a transmit slot is free */
+static void transmit_wait_slot(enc_device_t *dev)
+{
+	int polls = 0;
+
+	while (enc_transmit_poll(dev) == dev->tx.count) {
+		/* with a clock, enc_transmit_poll detects stuck frames */
+		if (dev->clock != NULL || ++polls < 10000)
+			continue;
+
+		polls = 0;
+		transmit_timeout(dev);
+	}
+}
+
+/* Bytes of an outgoing frame needed to find its checksum fields: Ethernet
+ * header, IPv4 header with options (longer than the IPv6 header), and
+ * transport header up to TCP's checksum field */
+#define TX_CHECKSUM_HEADER_SIZE (14 + 60 + 18)
+
+static uint32_t checksum_add(uint32_t sum, const uint8_t *data, uint8_t length)
+{
+	for (uint8_t i = 0; i < length; i += 2)
+		sum += (data[i] << 8) | data[i + 1];
+	return sum;
+}
+
+static uint16_t checksum_fold(uint32_t sum)
+{
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+	return sum;
+}
+
+/* Write a checksum into the frame at address, in network order */
+static void checksum_write(enc_device_t *dev, uint16_t address, uint16_t checksum)
+{
+	uint8_t bytes[2] = {checksum >> 8, checksum & 0xff};
+
+	enc_WBM(dev, bytes, address, 2);
+}
+
+/* Fill in the checksums enabled in dev->offload for the frame at `frame` in
+ * buffer memory, as long as their fields are still zero. `header` holds the
+ * frame's first headerlength bytes.
+ *
+ * IPv4 gets its header and UDP, TCP and ICMP checksums filled in; IPv6 (if
+ * the transport header directly follows the fixed header) UDP and TCP
+ * checksums. */
+static void transmit_checksums(enc_device_t *dev, uint16_t frame, const uint8_t *header, uint16_t headerlength)
+{
+	const uint8_t *ip = header + 14;
+	uint16_t iphl, l4length;
+	uint8_t proto, field;
+	uint8_t pseudoheader = 1;
+	uint8_t offload_flag;
+	uint16_t start, checksum;
+	uint32_t sum;
+
+	if (headerlength < 14 + 20)
+		return;
+
+	if (header[12] == 0x08 && header[13] == 0x00) {
+		uint16_t iplength = (ip[2] << 8) | ip[3];
+
+		iphl = (ip[0] & 0x0f) * 4;
+		if (iphl < 20 || 14 + iphl > headerlength || iplength < iphl)
+			return;
+
+		if ((dev->offload & ENC_OFFLOAD_TX_IP) && ip[10] == 0 && ip[11] == 0 &&
+				dma_checksum(dev, frame + 14, frame + 14 + iphl - 1, &checksum) == 0)
+			checksum_write(dev, frame + 14 + 10, checksum);
+
+		/* the transport checksum covers all fragments */
+		if ((ip[6] & 0x3f) != 0 || ip[7] != 0)
+			return;
+
+		proto = ip[9];
+		l4length = iplength - iphl;
+	} else if (header[12] == 0x86 && header[13] == 0xdd) {
+		iphl = 40;
+		if (14 + iphl > headerlength)
+			return;
+		/* extension headers are not followed */
+		proto = ip[6];
+		l4length = (ip[4] << 8) | ip[5];
+	} else {
+		return;
+	}
+
+	switch (proto) {
+	case 1:
+		if (iphl == 40) /* no ICMP in IPv6 */
+			return;
+		field = 2;
+		pseudoheader = 0;
+		offload_flag = ENC_OFFLOAD_TX_ICMP;
+		break;
+	case 6:
+		field = 16;
+		offload_flag = ENC_OFFLOAD_TX_TCP;
+		break;
+	case 17:
+		field = 6;
+		offload_flag = ENC_OFFLOAD_TX_UDP;
+		break;
+	default:
+		return;
+	}
+
+	if (!(dev->offload & offload_flag) || 14 + iphl + field + 2 > headerlength ||
+			l4length < field + 2 ||
+			ip[iphl + field] != 0 || ip[iphl + field + 1] != 0)
+		return;
+
+	start = frame + 14 + iphl;
+	/* the engine returns the complement of the sum over the data, which
+	 * gets the pseudo header's sum (addresses, protocol, length) added */
+	if (dma_checksum(dev, start, start + l4length - 1, &checksum) != 0)
+		return;
+	sum = (uint16_t)~checksum;
+	if (pseudoheader) {
+		if (iphl == 40)
+			sum = checksum_add(sum, ip + 8, 32);
+		else
+			sum = checksum_add(sum, ip + 12, 8);
+		sum += proto + l4length;
+	}
+	checksum = ~checksum_fold(sum);
+	/* zero means "no checksum" for UDP */
+	if (checksum == 0 && proto == 17)
+		checksum = 0xffff;
+
+	checksum_write(dev, start + field, checksum);
+}
+
+/* Partial function of enc_transmit. Always call this as transmit_start /
+ * {transmit_partial * n} / transmit_end -- and use enc_transmit or
+ * enc_transmit_pbuf unless you're just implementing those two.
+ *
+ * transmit_start returns non-zero if the frame does not fit in a transmit
+ * slot; the other functions must not be called then. transmit_end needs the
+ * frame's first bytes (up to TX_CHECKSUM_HEADER_SIZE) for checksum
+ * offloading. */
+int transmit_start(enc_device_t *dev, uint16_t length)
+{
+	/* according to section 7.1 */
+	uint8_t control_byte = 0; /* no overrides */
+
+	if (1 + length + 7 > dev->tx.slotsize)
+		return 1;
+
+	if (dev->tx.queued == dev->tx.count) {
+		dev->txstats.queue_full++;
+		transmit_wait_slot(dev);
+	}
+
+	/* 2. */
+	enc_WBM(dev, &control_byte, transmit_slot_address(dev, dev->tx.head), 1);
+
+	return 0;
+}
+
+void transmit_partial(enc_device_t *dev, uint8_t *data, uint16_t length)
+{
+	WBM_raw(dev, data, length);
+}
+
+void transmit_end(enc_device_t *dev, uint16_t length, const uint8_t *header, uint16_t headerlength)
+{
+	if (dev->offload)
+		transmit_checksums(dev, transmit_slot_address(dev, dev->tx.head) + 1, header, headerlength);
+
+	dev->tx.length[dev->tx.head] = length;
+	dev->tx.head = (dev->tx.head + 1) % dev->tx.count;
+	dev->tx.queued++;
+
+	/* checks for a completed frame first, so the new one can go out
+	 * immediately if the previous one is already sent */
+	enc_transmit_poll(dev);
+}
+
+/** Queue a frame for transmission. Returns 0 on success, or an unspecified
+ * error code if the frame is too large.
+ *
+ * This only blocks if all transmit slots are occupied, until the frame being
+ * sent is done. */
+int enc_transmit(enc_device_t *dev, uint8_t *data, uint16_t length)
+{
+	if (transmit_start(dev, length) != 0)
+		return 1;
 	transmit_partial(dev, data, length);
-	transmit_end(dev, length);
+	transmit_end(dev, length, data, length);
+	return 0;
 }
 
 #ifdef ENC28J60_USE_PBUF
 /** Like enc_transmit, but read from a pbuf. This is not a trivial wrapper
  * around enc_transmit as the pbuf is not guaranteed to have a contiguous
  * memory region to be transmitted. */
-void enc_transmit_pbuf(enc_device_t *dev, struct pbuf *buf)
+int enc_transmit_pbuf(enc_device_t *dev, struct pbuf *buf)
 {
 	uint16_t length = buf->tot_len;
 
-	/** @todo check buffer size */
-	transmit_start(dev);
+	uint8_t header[TX_CHECKSUM_HEADER_SIZE];
+	uint16_t headerlength = 0;
+
+	if (transmit_start(dev, length) != 0)
+		return 1;
+	if (dev->offload)
+		headerlength = pbuf_copy_partial(buf, header, sizeof(header), 0);
 	while(1) {
 		transmit_partial(dev, buf->payload, buf->len);
 		if (buf->len == buf->tot_len)
 			break;
 		buf = buf->next;
 	}
-	transmit_end(dev, length);
+	transmit_end(dev, length, header, headerlength);
+	return 0;
 }
 #endif
 
@@ -504,7 +1785,7 @@ void receive_end(enc_device_t *dev, uint8_t header[6])
 	 * enc_WCR16(dev, ENC_ERXRDPTL, next_location);
 	 * but thus: */
 	if (dev->next_frame_location == /* enc_RCR16(dev, ENC_ERXSTL) can be simplified because of errata item #5 */ 0)
-		enc_WCR16(dev, ENC_ERXRDPTL, enc_RCR16(dev, ENC_ERXNDL));
+		enc_WCR16(dev, ENC_ERXRDPTL, get_erxnd(dev));
 	else
 		enc_WCR16(dev, ENC_ERXRDPTL, dev->next_frame_location - 1);
 	/* workaround end */
@@ -541,43 +1822,517 @@ uint16_t enc_read_received(enc_device_t *dev, uint8_t *data, uint16_t maxlength)
 	return length;
 }
 
+#ifdef ENC28J60_USE_PBUF
+/* Address of the byte offset bytes after address in the receive buffer,
+ * which wraps from ERXND to ERXST (0, see errata #5) */
+static uint16_t rx_address(enc_device_t *dev, uint16_t address, uint16_t offset)
+{
+	uint32_t result = (uint32_t)address + offset;
+	uint16_t erxnd = get_erxnd(dev);
+
+	if (result > erxnd)
+		result -= erxnd + 1;
+	return result;
+}
+
+/* Check the checksums enabled in dev->offload of the received frame at
+ * `frame` in the receive buffer, whose first bytes are in peek. Returns 0 if
+ * they are correct or can't be checked (transport checksums of fragments and
+ * behind IPv6 extension headers, which the stack has to check itself),
+ * non-zero if the frame is to be dropped: on a wrong checksum, if IP or
+ * transport lengths don't fit the frame, or if the DMA engine hangs.
+ *
+ * The DMA checksum engine wraps around the receive buffer just like the
+ * receiver does, so the ranges are only wrapped for setting up EDMAND. */
+static int receive_verify_checksums(enc_device_t *dev, uint16_t frame, const uint8_t *peek, uint16_t peeklength, uint16_t length)
+{
+	const uint8_t *ip = peek + 14;
+	uint16_t iphl, payloadlength;
+	uint8_t proto;
+	uint16_t flag, checksum;
+	uint32_t sum = 0;
+
+	if (peeklength < 14)
+		return 0;
+
+	if (peek[12] == 0x08 && peek[13] == 0x00) {
+		if (peeklength < 14 + 20)
+			return 1;
+		iphl = (ip[0] & 0x0f) * 4;
+		payloadlength = (ip[2] << 8) | ip[3];
+		proto = ip[9];
+
+		/* malformed or truncated; the stack would drop it too */
+		if (iphl < 20 || payloadlength < iphl || 14 + payloadlength > length)
+			return 1;
+		payloadlength -= iphl;
+
+		if (dev->offload & ENC_OFFLOAD_RX_IP) {
+			/* usually, the header is at hand already */
+			if (14 + iphl <= peeklength)
+				checksum = ~checksum_fold(checksum_add(0, ip, iphl));
+			else if (dma_checksum(dev, rx_address(dev, frame, 14), rx_address(dev, frame, 14 + iphl - 1), &checksum) != 0)
+				return 1;
+			if (checksum != 0)
+				return 1;
+		}
+
+		/* the transport checksum covers all fragments */
+		if ((ip[6] & 0x3f) != 0 || ip[7] != 0)
+			return 0;
+
+		/* pseudo header: addresses, protocol and length */
+		sum = checksum_add(0, ip + 12, 8);
+	} else if (peek[12] == 0x86 && peek[13] == 0xdd) {
+		if (peeklength < 14 + 40)
+			return 1;
+		iphl = 40;
+		payloadlength = (ip[4] << 8) | ip[5];
+		/* extension headers are not followed */
+		proto = ip[6];
+
+		sum = checksum_add(0, ip + 8, 32);
+	} else {
+		return 0;
+	}
+
+	switch (proto) {
+	case 1:
+		flag = ENC_OFFLOAD_RX_ICMP;
+		/* ICMP for IPv4 has no pseudo header */
+		sum = 0;
+		break;
+	case 58:
+		flag = ENC_OFFLOAD_RX_ICMP6;
+		break;
+	case 6:
+		flag = ENC_OFFLOAD_RX_TCP;
+		break;
+	case 17:
+		flag = ENC_OFFLOAD_RX_UDP;
+		/* an IPv4 datagram may come without a checksum */
+		if (peek[13] == 0x00 && 14 + iphl + 8 <= peeklength &&
+				ip[iphl + 6] == 0 && ip[iphl + 7] == 0)
+			return 0;
+		break;
+	default:
+		return 0;
+	}
+
+	if (!(dev->offload & flag))
+		return 0;
+	/* too short for its transport header's checksum, or truncated */
+	if (payloadlength < 4 || 14 + iphl + payloadlength > length)
+		return 1;
+
+	if (proto != 1)
+		sum += proto + payloadlength;
+
+	if (dma_checksum(dev, rx_address(dev, frame, 14 + iphl),
+			rx_address(dev, frame, 14 + iphl + payloadlength - 1), &checksum) != 0)
+		return 1;
+	sum += (uint16_t)~checksum;
+
+	return checksum_fold(sum) != 0xffff;
+}
+
+/* TTL of echo replies, the same lwIP uses by default */
+#define FAST_REPLY_TTL 255
+/* Ethernet header and ARP packet, or IPv4 and ICMP echo header */
+#define FAST_REPLY_HEADER_SIZE (14 + 28)
+
+/* Answer an ARP request for or an ICMP echo request to dev->fast_reply_ip,
+ * given the received frame's location and first bytes. Only the reply's
+ * headers are written over SPI; an echo's payload is copied from the receive
+ * buffer into the transmit slot by the DMA engine. Returns 0 if the frame was
+ * answered, non-zero if it is to be processed normally; the read pointer is
+ * then still right after the peeked bytes. Requests arriving while all
+ * transmit slots are taken are processed normally. */
+static int receive_fast_reply(enc_device_t *dev, uint16_t frame, const uint8_t *peek, uint16_t peeklength, uint16_t length)
+{
+	uint8_t reply[FAST_REPLY_HEADER_SIZE];
+	const uint8_t *ip = peek + 14;
+	uint8_t *replyip = reply + 14;
+	uint16_t iplength, checksum, start;
+
+	/* waiting for a slot would mean polling the transmitter, which
+	 * moves the read pointer; the stack can reply later instead */
+	if (peeklength < FAST_REPLY_HEADER_SIZE || dev->tx.queued == dev->tx.count)
+		return 1;
+
+	if (peek[12] == 0x08 && peek[13] == 0x06) {
+		/* Ethernet/IPv4 request for our address, broadcast or to us;
+		 * someone else claiming the address is left to the stack */
+		if (memcmp(ip, "\x00\x01\x08\x00\x06\x04\x00\x01", 8) != 0 ||
+				memcmp(ip + 24, dev->fast_reply_ip, 4) != 0 ||
+				memcmp(ip + 14, dev->fast_reply_ip, 4) == 0 ||
+				(memcmp(peek, "\xff\xff\xff\xff\xff\xff", 6) != 0 && memcmp(peek, dev->mac, 6) != 0))
+			return 1;
+
+		memcpy(reply, peek + 6, 6);
+		memcpy(reply + 6, dev->mac, 6);
+		memcpy(reply + 12, peek + 12, 9);
+		replyip[7] = 2; /* reply */
+		memcpy(replyip + 8, dev->mac, 6);
+		memcpy(replyip + 14, dev->fast_reply_ip, 4);
+		/* sender hardware and protocol address become the target */
+		memcpy(replyip + 18, ip + 8, 10);
+
+		return enc_transmit(dev, reply, FAST_REPLY_HEADER_SIZE);
+	}
+
+	/* IPv4 without options or fragmentation, ICMP echo request to us */
+	if (peek[12] != 0x08 || peek[13] != 0x00 || memcmp(peek, dev->mac, 6) != 0 ||
+			ip[0] != 0x45 || (ip[6] & 0x3f) != 0 || ip[7] != 0 || ip[9] != 1 ||
+			memcmp(ip + 16, dev->fast_reply_ip, 4) != 0 ||
+			ip[20] != 8 || ip[21] != 0)
+		return 1;
+
+	iplength = (ip[2] << 8) | ip[3];
+	if (iplength < 28 || 14 + iplength > length ||
+			checksum_fold(checksum_add(0, ip, 20)) != 0xffff)
+		return 1;
+
+	memcpy(reply, peek + 6, 6);
+	memcpy(reply + 6, dev->mac, 6);
+	memcpy(reply + 12, peek + 12, FAST_REPLY_HEADER_SIZE - 12);
+
+	replyip[8] = FAST_REPLY_TTL;
+	memcpy(replyip + 12, ip + 16, 4);
+	memcpy(replyip + 16, ip + 12, 4);
+	replyip[10] = replyip[11] = 0;
+	checksum = ~checksum_fold(checksum_add(0, replyip, 20));
+	replyip[10] = checksum >> 8;
+	replyip[11] = checksum & 0xff;
+
+	/* echo reply; the checksum is updated for the type change as in RFC
+	 * 1624 (the payload is not even read, so a broken request gets a
+	 * reply that's just as broken) */
+	replyip[20] = 0;
+	checksum = ~checksum_fold((uint16_t)~((ip[22] << 8) | ip[23]) + (uint16_t)~0x0800);
+	replyip[22] = checksum >> 8;
+	replyip[23] = checksum & 0xff;
+
+	if (transmit_start(dev, 14 + iplength) != 0)
+		return 1;
+	start = transmit_slot_address(dev, dev->tx.head) + 1;
+	enc_WBM(dev, reply, start, FAST_REPLY_HEADER_SIZE);
+	/* the slot is only taken by transmit_end; without it, the request is
+	 * left to the stack, which continues reading after the peeked bytes */
+	if (14 + iplength > FAST_REPLY_HEADER_SIZE &&
+			dma_copy(dev, rx_address(dev, frame, FAST_REPLY_HEADER_SIZE), rx_address(dev, frame, 14 + iplength - 1), start + FAST_REPLY_HEADER_SIZE) != 0) {
+		enc_WCR16(dev, ENC_ERDPTL, rx_address(dev, frame, peeklength));
+		return 1;
+	}
+	transmit_end(dev, 14 + iplength, reply, FAST_REPLY_HEADER_SIZE);
+
+	return 0;
+}
+#endif
+
+/** Extract the fields receive rules look at from the first `length` bytes of
+ * a frame. Fields that are not contained in those bytes are left zero. */
+void enc_frame_classify(const uint8_t *frame, uint16_t length, enc_frame_info_t *info)
+{
+	const uint8_t *ip = frame + 14;
+	const uint8_t *transport = NULL;
+	uint16_t headerlength;
+
+	memset(info, 0, sizeof(*info));
+
+	if (length < 14)
+		return;
+	info->ethertype = (frame[12] << 8) | frame[13];
+	length -= 14;
+
+	if (info->ethertype == 0x0800 && length >= 20) {
+		info->ipproto = ip[9];
+		headerlength = (ip[0] & 0x0f) * 4;
+		/* only the first fragment has the transport header */
+		if ((ip[6] & 0x1f) == 0 && ip[7] == 0 && length >= headerlength + 4)
+			transport = ip + headerlength;
+	} else if (info->ethertype == 0x86dd && length >= 40) {
+		/* extension headers are not followed */
+		info->ipproto = ip[6];
+		if (length >= 44)
+			transport = ip + 40;
+	}
+
+	if (transport != NULL && (info->ipproto == 6 || info->ipproto == 17)) {
+		info->has_ports = 1;
+		info->srcport = (transport[0] << 8) | transport[1];
+		info->dstport = (transport[2] << 8) | transport[3];
+	}
+}
+
+/** Have ARP requests for and ICMP echo requests to the IPv4 address ipaddr
+ * (in network order) answered by @ref enc_read_received_pbuf_start itself,
+ * without reading the request's payload or passing it on. Pass NULL to turn
+ * this off again.
+ *
+ * The stack does not see those requests, so it will neither count them nor
+ * learn the requester's MAC address from them. */
+void enc_fast_reply_set(enc_device_t *dev, const uint8_t ipaddr[4])
+{
+	dev->fast_reply = ipaddr != NULL;
+	if (ipaddr != NULL)
+		memcpy(dev->fast_reply_ip, ipaddr, 4);
+}
+
+/** Install a table of receive rules, which gets evaluated on the headers of
+ * every frame read by @ref enc_read_received_pbuf_start before anything
+ * else is read: the first matching rule decides whether the frame is
+ * accepted or skipped; frames that match no rule are accepted (and passed to
+ * rx_filter, if set). The table is not copied; pass NULL to remove it. */
+void enc_rx_rules_set(enc_device_t *dev, const enc_rx_rule_t *rules, uint8_t count)
+{
+	dev->rx_rules = rules;
+	dev->rx_rule_count = rules != NULL ? count : 0;
+}
+
+#ifdef ENC28J60_USE_PBUF
+static int rx_rules_apply(enc_device_t *dev, const uint8_t *frame, uint16_t peeklength)
+{
+	enc_frame_info_t info;
+	const enc_rx_rule_t *rule;
+
+	enc_frame_classify(frame, peeklength, &info);
+
+	for (rule = dev->rx_rules; rule < dev->rx_rules + dev->rx_rule_count; ++rule) {
+		if ((rule->match & ENC_RULE_ETHERTYPE) && rule->ethertype != info.ethertype)
+			continue;
+		if ((rule->match & ENC_RULE_IPPROTO) && rule->ipproto != info.ipproto)
+			continue;
+		if ((rule->match & ENC_RULE_DSTPORT) && (!info.has_ports || rule->dstport != info.dstport))
+			continue;
+		if ((rule->match & ENC_RULE_SRCMAC) && (peeklength < 12 || memcmp(rule->srcmac, frame + 6, 6) != 0))
+			continue;
+		return rule->action;
+	}
+
+	return ENC_RX_ACCEPT;
+}
+#endif
+
+#ifdef ENC28J60_RX_POOL
+/* A segment of the receive pool; the pbuf_custom has to come first, as the
+ * free function gets the pbuf pointer. */
+struct rx_pool_segment {
+	struct pbuf_custom p;
+	struct rx_pool_segment *next_free;
+	uint32_t data[(ENC_RX_POOL_SEGMENT_SIZE + 3) / 4];
+};
+
+static struct rx_pool_segment rx_pool[ENC_RX_POOL_SEGMENTS];
+static struct rx_pool_segment *rx_pool_free_list;
+static uint8_t rx_pool_initialized;
+static enc_rx_pool_stats_t rx_pool_usage;
+
+static void rx_pool_init(void)
+{
+	for (int i = 0; i < ENC_RX_POOL_SEGMENTS; ++i)
+		rx_pool[i].next_free = i + 1 < ENC_RX_POOL_SEGMENTS ? &rx_pool[i + 1] : NULL;
+	rx_pool_free_list = &rx_pool[0];
+	rx_pool_usage.size = ENC_RX_POOL_SEGMENTS;
+	rx_pool_initialized = 1;
+}
+
+/* Called by lwIP when a segment is freed; that can happen from any context
+ * lwIP runs in */
+static void rx_pool_free(struct pbuf *p)
+{
+	struct rx_pool_segment *segment = (struct rx_pool_segment*)p;
+	SYS_ARCH_DECL_PROTECT(old_level);
+
+	SYS_ARCH_PROTECT(old_level);
+	segment->next_free = rx_pool_free_list;
+	rx_pool_free_list = segment;
+	rx_pool_usage.used--;
+	SYS_ARCH_UNPROTECT(old_level);
+}
+
+/* Take enough segments for length bytes from the pool and chain them, or
+ * return NULL if there are not enough of them. */
+static struct pbuf *rx_pool_alloc(uint16_t length)
+{
+	uint16_t count = (length + ENC_RX_POOL_SEGMENT_SIZE - 1) / ENC_RX_POOL_SEGMENT_SIZE;
+	struct rx_pool_segment *taken;
+	struct pbuf *head = NULL, *p;
+	uint16_t seglength;
+	SYS_ARCH_DECL_PROTECT(old_level);
+
+	if (!rx_pool_initialized)
+		rx_pool_init();
+
+	SYS_ARCH_PROTECT(old_level);
+	if (count == 0 || rx_pool_usage.used + count > ENC_RX_POOL_SEGMENTS) {
+		rx_pool_usage.exhausted++;
+		SYS_ARCH_UNPROTECT(old_level);
+		return NULL;
+	}
+	taken = rx_pool_free_list;
+	for (uint16_t i = 0; i < count; ++i)
+		rx_pool_free_list = rx_pool_free_list->next_free;
+	rx_pool_usage.used += count;
+	if (rx_pool_usage.used > rx_pool_usage.high_water)
+		rx_pool_usage.high_water = rx_pool_usage.used;
+	SYS_ARCH_UNPROTECT(old_level);
+
+	while (count--) {
+		struct rx_pool_segment *segment = taken;
+		taken = taken->next_free;
+
+		seglength = length > ENC_RX_POOL_SEGMENT_SIZE ? ENC_RX_POOL_SEGMENT_SIZE : length;
+		length -= seglength;
+
+		segment->p.custom_free_function = rx_pool_free;
+		p = pbuf_alloced_custom(PBUF_RAW, seglength, PBUF_REF, &segment->p, segment->data, ENC_RX_POOL_SEGMENT_SIZE);
+		if (head == NULL)
+			head = p;
+		else
+			pbuf_cat(head, p);
+	}
+
+	return head;
+}
+
+/** Report the receive pool's size and usage, to help with sizing
+ * ENC_RX_POOL_SEGMENTS. */
+void enc_rx_pool_stats(enc_rx_pool_stats_t *stats)
+{
+	SYS_ARCH_DECL_PROTECT(old_level);
+
+	if (!rx_pool_initialized)
+		rx_pool_init();
+
+	SYS_ARCH_PROTECT(old_level);
+	*stats = rx_pool_usage;
+	SYS_ARCH_UNPROTECT(old_level);
+}
+#endif
+
 #ifdef ENC28J60_USE_PBUF
 /** Like enc_read_received, but allocate a pbuf buf. Returns 0 on success, or
  * unspecified non-zero values on errors. */
 int enc_read_received_pbuf(enc_device_t *dev, struct pbuf **buf)
 {
-	uint8_t header[6];
+	if (*buf != NULL)
+		return 1;
+
+	if (enc_read_received_pbuf_start(dev) != 0)
+		return 2;
+
+	return enc_read_received_pbuf_finish(dev, buf);
+}
+
+/** First half of enc_read_received_pbuf: Allocate a pbuf for the next
+ * received frame and start reading it using @ref enc_RBM_start.
+ *
+ * Returns 0 if the frame is being read; it has to be collected with @ref
+ * enc_read_received_pbuf_finish, preferably after @ref enc_transfer_busy
+ * indicated that the transfer is complete. Returns unspecified non-zero values
+ * if the frame was discarded or a frame is still pending. */
+int enc_read_received_pbuf_start(enc_device_t *dev)
+{
+	uint8_t *header = dev->rx_pending_header;
 	uint16_t length;
+	uint8_t peek[ENC_RX_PEEK_SIZE];
+	uint16_t peeklength = 0;
+	uint16_t offset = 0, chunk;
+	struct pbuf *q;
 
-	if (*buf != NULL)
+	if (dev->rx_pending != NULL)
 		return 1;
 
 	receive_start(dev, header, &length);
 	if (length < 4) {
 		/* This could be indicative of a crashed (brown-outed?) ENC28J60 controller */
 		DEBUG("Empty frame (length %u)\n", length);
-		goto end;
+		goto discard;
 	}
 	length -= 4; /* Drop the 4 byte CRC from length */
 
 	/* workaround for https://savannah.nongnu.org/bugs/index.php?50040 */
 	if (length > 32000) {
 		DEBUG("Huge frame received or underflow (framelength %u)\n", length);
-		goto end;
+		goto discard;
+	}
+
+	/* Only the headers are read before the frame is known to be wanted;
+	 * they are copied into the pbuf later rather than read again. */
+	if (dev->rx_rule_count != 0 || dev->rx_filter != NULL || (dev->offload & ENC_OFFLOAD_RX) || dev->fast_reply) {
+		peeklength = length < ENC_RX_PEEK_SIZE ? length : ENC_RX_PEEK_SIZE;
+		enc_RBM(dev, peek, ENC_READLOCATION_ANY, peeklength);
+
+		if (rx_rules_apply(dev, peek, peeklength) != ENC_RX_ACCEPT ||
+				(dev->rx_filter != NULL && dev->rx_filter(dev->rx_filter_arg, peek, peeklength, length) != ENC_RX_ACCEPT)) {
+			dev->rx_filtered++;
+			goto discard;
+		}
+
+		if ((dev->offload & ENC_OFFLOAD_RX) &&
+				receive_verify_checksums(dev, rx_address(dev, dev->next_frame_location, 6), peek, peeklength, length) != 0) {
+			dev->rx_checksum_errors++;
+			goto discard;
+		}
+
+		if (dev->fast_reply &&
+				receive_fast_reply(dev, rx_address(dev, dev->next_frame_location, 6), peek, peeklength, length) == 0) {
+			dev->fast_replies++;
+			goto discard;
+		}
 	}
 
-	*buf = pbuf_alloc(PBUF_RAW, length, PBUF_RAM);
+#ifdef ENC28J60_RX_POOL
+	dev->rx_pending = rx_pool_alloc(length);
+#else
+	dev->rx_pending = pbuf_alloc(PBUF_RAW, length, PBUF_RAM);
+#endif
 
-	if (*buf == NULL) {
+	if (dev->rx_pending == NULL) {
 		DEBUG("failed to allocate buf of length %u, discarding\n", length);
-		goto end;
+		goto discard;
 	}
 
-	enc_RBM(dev, (*buf)->payload, ENC_READLOCATION_ANY, length);
+	/* Scatter the frame over the pbuf chain; the read pointer keeps
+	 * advancing (and wrapping) between the reads. Only the last segment
+	 * is read in the background. */
+	for (q = dev->rx_pending; q != NULL; q = q->next) {
+		chunk = peeklength - offset < q->len ? peeklength - offset : q->len;
+		memcpy(q->payload, peek + offset, chunk);
+		offset += chunk;
 
-end:
+		if (chunk == q->len)
+			continue;
+		if (q->next == NULL)
+			enc_RBM_start(dev, (uint8_t*)q->payload + chunk, ENC_READLOCATION_ANY, q->len - chunk);
+		else
+			enc_RBM(dev, (uint8_t*)q->payload + chunk, ENC_READLOCATION_ANY, q->len - chunk);
+	}
+
+	return 0;
+
+discard:
 	receive_end(dev, header);
 
-	return (*buf == NULL) ? 2 : 0;
+	return 2;
+}
+
+/** Second half of enc_read_received_pbuf: Wait for the frame started with
+ * @ref enc_read_received_pbuf_start to be read completely, release its
+ * space in the receive buffer and hand it out in buf. Returns 0 on success, or
+ * unspecified non-zero values if no frame was pending. */
+int enc_read_received_pbuf_finish(enc_device_t *dev, struct pbuf **buf)
+{
+	if (dev->rx_pending == NULL)
+		return 1;
+
+	enc_transfer_finish(dev);
+	receive_end(dev, dev->rx_pending_header);
+
+	*buf = dev->rx_pending;
+	dev->rx_pending = NULL;
+
+	return 0;
 }
 #endif
@@ -20,18 +20,339 @@
 #include <lwip/pbuf.h>
 #endif
 
+#ifdef ENC28J60_RX_POOL
+/** Number of segments in the receive pbuf pool (see @ref
+ * enc_rx_pool_stats) */
+#ifndef ENC_RX_POOL_SEGMENTS
+#define ENC_RX_POOL_SEGMENTS 12
+#endif
+/** Payload size of a receive pool segment; frames are scattered over as
+ * many segments as needed. Should be a multiple of 4. */
+#ifndef ENC_RX_POOL_SEGMENT_SIZE
+#define ENC_RX_POOL_SEGMENT_SIZE 512
+#endif
+
+/** Usage information of the receive pbuf pool */
+typedef struct {
+	/** Number of segments in the pool */
+	uint16_t size;
+	/** Number of segments currently handed out */
+	uint16_t used;
+	/** Highest value `used` ever had */
+	uint16_t high_water;
+	/** Number of frames discarded because the pool was exhausted */
+	uint32_t exhausted;
+} enc_rx_pool_stats_t;
+#endif
+
+/** Number of transmit buffers set up in the memory above the receive buffer,
+ * space permitting. While one frame is being sent, the next ones can be
+ * written to the other buffers. */
+#ifndef ENC_TX_SLOTS
+#define ENC_TX_SLOTS 2
+#endif
+
+/** How often a frame is sent again after a late collision, an aborted
+ * transmission or a transmitter that got stuck (errata #12 and #13) before it
+ * is given up */
+#ifndef ENC_TX_RETRIES
+#define ENC_TX_RETRIES 3
+#endif
+
+/** Time after which a transmission is considered stuck, in microseconds.
+ * This is only measured if the device has a clock; without it, a stuck frame
+ * is only detected when a new frame waits for a slot, after some 10000 polls.
+ * The default allows for a full sized frame with maximum deferral and backoff
+ * on a busy half duplex link. */
+#ifndef ENC_TX_TIMEOUT_US
+#define ENC_TX_TIMEOUT_US 50000
+#endif
+
+/** Highest SPI clock the ENC28J60 supports, in Hz (see @ref enc_spi_calibrate) */
+#define ENC_SPI_MAX_HZ 20000000
+
+/** Percentage by which @ref enc_spi_calibrate stays below the fastest SPI
+ * clock that passed its tests */
+#ifndef ENC_SPI_MARGIN
+#define ENC_SPI_MARGIN 25
+#endif
+
+/** Space needed for a transmit slot: control byte, maximum frame size without
+ * CRC (which gets appended by the MAC) and transmit status vector */
+#define ENC_TX_SLOT_SIZE (1 + 1518 + 7)
+/** Largest receive buffer size (see @ref enc_ethernet_setup) that leaves
+ * room for a full sized transmit slot */
+#define ENC_RXBUFSIZE_MAX (ENC_RAMSIZE - ENC_TX_SLOT_SIZE - 1)
+
+/** Duplex modes, see @ref enc_duplex */
+#define ENC_DUPLEX_HALF 0
+#define ENC_DUPLEX_FULL 1
+
+/** Outcome of a transmission */
+typedef enum {
+	ENC_TX_OK = 0,
+	ENC_TX_LATECOLLISION,
+	ENC_TX_EXCESSIVECOLLISION,
+	ENC_TX_EXCESSIVEDEFER,
+	/** Aborted for any other reason (eg. underrun) */
+	ENC_TX_ABORTED,
+	/** The transmitter did not finish and was reset (errata #12); no
+	 * status vector is available */
+	ENC_TX_TIMEOUT,
+} enc_tx_result_t;
+
+/** Decoded transmit status vector of a frame whose transmission finished */
+typedef struct {
+	enc_tx_result_t result;
+	/** Frame length as reported by the chip, or as queued for ENC_TX_TIMEOUT */
+	uint16_t length;
+	/** Bytes on the wire, including collided attempts and padding */
+	uint16_t wire_length;
+	/** Bits 16 to 31 of the status vector (ENC_TSV_*); number of collisions
+	 * in ENC_TSV_COLLISIONCOUNT */
+	uint16_t flags;
+} enc_tx_status_t;
+
+/** Number of bytes at the start of a received frame that get read before a
+ * receive filter decides whether to read the frame at all */
+#ifndef ENC_RX_PEEK_SIZE
+#define ENC_RX_PEEK_SIZE 64
+#endif
+
+/** @{ Return values of an enc_rx_filter_t */
+#define ENC_RX_ACCEPT 0
+#define ENC_RX_DROP 1
+/** @} */
+
+/** Receive filter callback, see enc_device_t's rx_filter. `frame` holds the
+ * first `peeklength` bytes of the frame, which is `length` bytes long
+ * (without CRC). */
+typedef int (*enc_rx_filter_t)(void *arg, const uint8_t *frame, uint16_t peeklength, uint16_t length);
+
+/** Header fields of a received frame, as extracted by @ref
+ * enc_frame_classify from the frame's first bytes */
+typedef struct {
+	uint16_t ethertype;
+	/** IP protocol (IPv6: next header), or 0 if not IP */
+	uint8_t ipproto;
+	/** Set if srcport and dstport are valid (TCP or UDP, and not a later
+	 * IPv4 fragment) */
+	uint8_t has_ports;
+	uint16_t srcport;
+	uint16_t dstport;
+} enc_frame_info_t;
+
+/** @{ Fields an enc_rx_rule_t compares */
+#define ENC_RULE_ETHERTYPE 0x01
+#define ENC_RULE_IPPROTO 0x02
+#define ENC_RULE_DSTPORT 0x04
+#define ENC_RULE_SRCMAC 0x08
+/** @} */
+
+/** Entry of the receive rule table (see @ref enc_rx_rules_set). A rule
+ * matches if all fields selected in `match` are equal; a rule with
+ * ENC_RULE_DSTPORT only matches TCP and UDP. */
+typedef struct {
+	uint8_t match;
+	/** ENC_RX_ACCEPT or ENC_RX_DROP */
+	uint8_t action;
+	uint8_t ipproto;
+	uint16_t ethertype;
+	uint16_t dstport;
+	uint8_t srcmac[6];
+} enc_rx_rule_t;
+
+/** Size of the pattern match filter's window */
+#define ENC_PATTERN_SIZE 64
+
+/** @{ Checksums computed by the chip's DMA checksum engine instead of the
+ * MCU, see enc_device_t's offload */
+#define ENC_OFFLOAD_TX_IP 0x01
+#define ENC_OFFLOAD_TX_UDP 0x02
+#define ENC_OFFLOAD_TX_TCP 0x04
+#define ENC_OFFLOAD_TX_ICMP 0x08
+#define ENC_OFFLOAD_RX_IP 0x10
+#define ENC_OFFLOAD_RX_UDP 0x20
+#define ENC_OFFLOAD_RX_TCP 0x40
+#define ENC_OFFLOAD_RX_ICMP 0x80
+#define ENC_OFFLOAD_RX_ICMP6 0x100
+#define ENC_OFFLOAD_RX (ENC_OFFLOAD_RX_IP | ENC_OFFLOAD_RX_UDP | ENC_OFFLOAD_RX_TCP | ENC_OFFLOAD_RX_ICMP | ENC_OFFLOAD_RX_ICMP6)
+/** @} */
+
 /** Container that stores locally cached information about the ENC28J60 device
  * (eg. last used register) to optimize access. */
 
 typedef struct {
-	/** The chip's active register page ENC_ECON1[0:1] */
+	/** The chip's active register page ENC_ECON1[0:1], in the form of the
+	 * ENC_BANKn constants, or ENC_BANK_INDETERMINATE if not known */
 	enc_register_t last_used_register;
-	/** Configured receiver buffer size; cached value of of ERXND[H:L] */
+	/** Number of BFS/BFC commands on ECON1 that were avoided by knowing
+	 * last_used_register, compared to always setting and clearing the
+	 * BSEL bits for banked register accesses */
+	uint32_t bank_switches_saved;
+	/** Configured receiver buffer size; cached value of of ERXND[H:L], or ~0
+	 * after a direct write to those registers until it is read again */
 	uint16_t rxbufsize;
+	/** Receive buffer size for the interface driver to pass to @ref
+	 * enc_ethernet_setup; the memory above goes to transmit slots. This
+	 * is configuration, not touched by the driver itself; 0 selects the
+	 * interface driver's default. */
+	uint16_t rxbufsize_setting;
+	/** Duplex mode (ENC_DUPLEX_*) @ref enc_ethernet_setup configures the
+	 * MAC and PHY for. There is no autonegotiation, so full duplex needs
+	 * the link partner to be fixed to full duplex as well. Configuration,
+	 * left alone by the driver. */
+	uint8_t duplex_setting;
+	/** Receive buffer fill levels, in percent of its size, at which @ref
+	 * enc_flow_control_poll starts and stops holding off the link
+	 * partner; flow_low has to be below flow_high, or it is taken as
+	 * flow_high - 1. Flow control is off while flow_high is 0. Configuration,
+	 * left alone by the driver. */
+	uint8_t flow_high;
+	uint8_t flow_low;
+	/** Set while flow control holds off the link partner */
+	uint8_t flow_active;
+	/** Receive buffer overflows (ENC_EIR_RXERIF) seen by the interface
+	 * driver */
+	uint32_t rx_overflows;
+	/** Statistics at the time the interface driver last considered
+	 * resizing the receive buffer */
+	struct {
+		uint32_t rx_overflows;
+		uint32_t queue_full;
+	} adapt;
+
+	/** Shadow copies of registers that are only ever changed by the driver,
+	 * so unchanged writes can be skipped and reads served locally. Members
+	 * are only valid if their bit is set in `valid`; everything gets
+	 * invalidated when the chip is reset. */
+	struct {
+		uint8_t valid;
+		uint16_t etxst;
+		uint8_t erxfcon;
+		uint8_t macon1;
+		uint8_t macon3;
+		uint16_t phlcon;
+	} shadow;
 
 	/** Where to start reading the next received frame */
 	uint16_t next_frame_location;
 
+	/** Transmit buffers, used as a ring: frames are written to `head`,
+	 * and `tail` is the oldest frame that was not sent yet */
+	struct {
+		/** Number of usable slots, and the space for each of them */
+		uint8_t count;
+		uint16_t slotsize;
+		uint8_t head;
+		uint8_t tail;
+		/** Number of frames in the ring, including the one being sent */
+		uint8_t queued;
+		/** Set while the frame at `tail` is being sent */
+		uint8_t active;
+		/** Number of times the frame at `tail` was sent again */
+		uint8_t retries;
+		/** Clock value at which the frame at `tail` is considered stuck */
+		uint32_t deadline;
+		uint16_t length[ENC_TX_SLOTS];
+	} tx;
+
+	/** Optional clock for timeouts, returning a free running tick count
+	 * (wrapping at 2^32) that advances clock_hz times per second. With it,
+	 * waiting for the chip is bounded by time rather than by a number of
+	 * register reads, which depends on the SPI speed. Configuration, left
+	 * alone by the driver; set it before @ref enc_setup_basic. */
+	uint32_t (*clock)(void);
+	uint32_t clock_hz;
+	/** Number of waits for the chip (MII, DMA, receiver) that timed out;
+	 * anything but 0 indicates a hung chip */
+	uint32_t wait_timeouts;
+
+	/** Checksum offloading (ENC_OFFLOAD_*). For outgoing IPv4 frames (and
+	 * UDP and TCP over IPv6), enabled checksums whose field is zero get
+	 * computed in the chip after the frame is written. Received frames are verified in the
+	 * receive buffer by @ref enc_read_received_pbuf_start and dropped if
+	 * an enabled checksum is wrong. Cleared by @ref enc_setup_basic. */
+	uint16_t offload;
+	/** Number of received frames dropped because of a bad checksum */
+	uint32_t rx_checksum_errors;
+
+	/** Transmission counters, accumulated since @ref enc_setup_basic */
+	struct {
+		/** Successfully sent frames and their bytes on the wire */
+		uint32_t frames;
+		uint32_t bytes;
+		/** Collisions that were resolved by retrying */
+		uint32_t collisions;
+		/** Frames that had to wait for the medium */
+		uint32_t deferred;
+		/** Frames that had to wait for a free transmit slot */
+		uint32_t queue_full;
+		/** Transmissions that were repeated, see ENC_TX_RETRIES */
+		uint32_t retries;
+		/** Frames that were sent successfully after being repeated */
+		uint32_t recovered;
+		/** Failed frames, by enc_tx_result_t */
+		uint32_t late_collisions;
+		uint32_t excessive_collisions;
+		uint32_t excessive_defers;
+		uint32_t aborted;
+		uint32_t timeouts;
+	} txstats;
+
+	/** If set, called after each frame's transmission finished. Set it
+	 * after @ref enc_setup_basic, which clears it. */
+	void (*tx_done)(void *arg, const enc_tx_status_t *status);
+	void *tx_done_arg;
+
+	/** If set, called with the beginning of every received frame (that
+	 * passed rx_rules) before it is read by @ref
+	 * enc_read_received_pbuf_start; frames for which it returns
+	 * ENC_RX_DROP are skipped without reading the rest or
+	 * allocating a pbuf. Set it after @ref enc_setup_basic, which clears
+	 * it. */
+	enc_rx_filter_t rx_filter;
+	void *rx_filter_arg;
+	/** Number of multicast groups using each of the 64 hash table
+	 * filter bits (see @ref enc_multicast_add) */
+	uint8_t multicast_refs[64];
+
+	/** Set while only the wake-up filters receive frames, see @ref
+	 * enc_wake_filters_only; erxfcon_awake is the ERXFCON to return to */
+	uint8_t wake_filters_only;
+	uint8_t erxfcon_awake;
+
+	/** MAC address as configured by @ref enc_ethernet_setup */
+	uint8_t mac[6];
+	/** Set if ARP and ICMP echo requests for fast_reply_ip are answered
+	 * by the driver, see @ref enc_fast_reply_set */
+	uint8_t fast_reply;
+	uint8_t fast_reply_ip[4];
+	/** Number of requests answered that way */
+	uint32_t fast_replies;
+
+	/** Receive rule table, see @ref enc_rx_rules_set */
+	const enc_rx_rule_t *rx_rules;
+	uint8_t rx_rule_count;
+	/** Number of frames skipped because of rx_rules or rx_filter */
+	uint32_t rx_filtered;
+
+	/** State of the MII scan used for link monitoring (see @ref
+	 * enc_link_monitor_start): 0 if off, 1 if MIRD reflects PHSTAT2, 2 if
+	 * the scan was just (re)started and MIRD may not be valid yet */
+	uint8_t mii_scan;
+
+	/** Set while an asynchronous buffer memory read started by @ref
+	 * enc_RBM_start still holds the SPI bus */
+	uint8_t transfer_pending;
+#ifdef ENC28J60_USE_PBUF
+	/** Frame that is being read by @ref enc_read_received_pbuf_start and
+	 * has not been handed out by @ref enc_read_received_pbuf_finish yet */
+	struct pbuf *rx_pending;
+	/** Receive status vector of the frame in rx_pending */
+	uint8_t rx_pending_header[6];
+#endif
+
 	/** Pointer for the hardware implementation to access device
 	 * information */
 	void *hwdev;
@@ -40,6 +361,7 @@ typedef struct {
 int enc_setup_basic(enc_device_t *dev);
 uint8_t enc_bist(enc_device_t *dev);
 uint8_t enc_bist_manual(enc_device_t *dev);
+uint32_t enc_spi_calibrate(enc_device_t *dev, uint32_t max_hz);
 uint8_t enc_RCR(enc_device_t *dev, enc_register_t reg);
 uint16_t enc_RCR16(enc_device_t *dev, enc_register_t reg);
 void enc_WCR(enc_device_t *dev, uint8_t reg, uint8_t data);
@@ -49,19 +371,49 @@ void enc_BFC(enc_device_t *dev, uint8_t reg, uint8_t data);
 void enc_SRC(enc_device_t *dev);
 void enc_RBM(enc_device_t *dev, uint8_t *dest, uint16_t start, uint16_t length);
 void enc_WBM(enc_device_t *dev, uint8_t *src, uint16_t start, uint16_t length);
+void enc_RBM_start(enc_device_t *dev, uint8_t *dest, uint16_t start, uint16_t length);
+int enc_transfer_busy(enc_device_t *dev);
+void enc_transfer_finish(enc_device_t *dev);
 int enc_wait(enc_device_t *dev);
 uint16_t enc_MII_read(enc_device_t *dev, enc_register_t mireg);
 void enc_MII_write(enc_device_t *dev, uint8_t mireg, uint16_t data);
 void enc_LED_set(enc_device_t *dev, enc_lcfg_t ledconfig, enc_led_t led);
+void enc_link_monitor_start(enc_device_t *dev);
+int enc_link_state(enc_device_t *dev);
+int enc_duplex(enc_device_t *dev);
+
+void enc_interrupts_setup(enc_device_t *dev, uint8_t eie);
+int enc_interrupt_pending(enc_device_t *dev);
+uint8_t enc_interrupt_flags(enc_device_t *dev);
+void enc_interrupt_clear(enc_device_t *dev, uint8_t eir);
 
 void enc_ethernet_setup(enc_device_t *dev, uint16_t rxbufsize, uint8_t mac[6]);
-void enc_transmit(enc_device_t *dev, uint8_t *data, uint16_t length);
+int enc_rx_buffer_resize(enc_device_t *dev, uint16_t rxbufsize);
+int enc_flow_control_poll(enc_device_t *dev);
+int enc_transmit(enc_device_t *dev, uint8_t *data, uint16_t length);
+int enc_transmit_poll(enc_device_t *dev);
 void enc_set_multicast_reception(enc_device_t *dev, int enable);
+int enc_multicast_add(enc_device_t *dev, const uint8_t mac[6]);
+int enc_multicast_remove(enc_device_t *dev, const uint8_t mac[6]);
+void enc_pattern_match_set(enc_device_t *dev, uint16_t offset, const uint8_t pattern[ENC_PATTERN_SIZE], const uint8_t mask[ENC_PATTERN_SIZE / 8]);
+void enc_pattern_match_disable(enc_device_t *dev);
+void enc_magic_packet_set(enc_device_t *dev, int enable);
+void enc_wake_filters_only(enc_device_t *dev, int enable);
 uint16_t enc_read_received(enc_device_t *dev, uint8_t *data, uint16_t maxlength);
 
+void enc_frame_classify(const uint8_t *frame, uint16_t length, enc_frame_info_t *info);
+void enc_rx_rules_set(enc_device_t *dev, const enc_rx_rule_t *rules, uint8_t count);
+void enc_fast_reply_set(enc_device_t *dev, const uint8_t ipaddr[4]);
+
 #ifdef ENC28J60_USE_PBUF
 int enc_read_received_pbuf(enc_device_t *dev, struct pbuf **buf);
-void enc_transmit_pbuf(enc_device_t *dev, struct pbuf *buf);
+int enc_read_received_pbuf_start(enc_device_t *dev);
+int enc_read_received_pbuf_finish(enc_device_t *dev, struct pbuf **buf);
+int enc_transmit_pbuf(enc_device_t *dev, struct pbuf *buf);
+#endif
+
+#ifdef ENC28J60_RX_POOL
+void enc_rx_pool_stats(enc_rx_pool_stats_t *stats);
 #endif
 
 /** @} */
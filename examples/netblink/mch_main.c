@@ -14,6 +14,10 @@
 #include <board.h>
 #include <enc28j60.h>
 
+#ifdef MCHDRV_USE_INTERRUPTS
+#include <em_cmu.h>
+#endif
+
 #include <testapp.h>
 
 struct ip_addr mch_myip_addr = {0x0200a8c0UL}; /* 192.168.0.2 */
@@ -37,6 +41,10 @@ void mch_net_init(void)
     mchdrv_netif.hwaddr[4] = 4;
     mchdrv_netif.hwaddr[5] = 5;
 
+    /* bound the driver's waits for the chip in time */
+    mchdrv_hw.clock = rtc_get32;
+    mchdrv_hw.clock_hz = rtc_get_ticks_per_second();
+
     // Add our netif to LWIP (netif_add calls our driver initialization function)
     if (netif_add(&mchdrv_netif, &mch_myip_addr, &netmask, &gw_addr, &mchdrv_hw,
                 mchdrv_init, ethernet_input) == NULL) {
@@ -47,11 +55,31 @@ void mch_net_init(void)
     netif_set_up(&mchdrv_netif);
 }
 
-void mch_net_poll(void)
+int mch_net_poll(void)
+{
+    return mchdrv_poll(&mchdrv_netif);
+}
+
+#ifdef MCHDRV_USE_INTERRUPTS
+/* Wakes the main loop regularly for lwIP's timers */
+void SysTick_Handler(void)
 {
-    mchdrv_poll(&mchdrv_netif);
 }
 
+/* Sleep until the INT line or the SysTick wakes the MCU. INT is held low
+ * while anything is pending, so a frame that arrived during the last poll
+ * produces no new falling edge; the line has to be checked right before
+ * sleeping. With interrupts masked, an edge between the check and the WFI
+ * still ends the sleep. */
+static void mch_sleep(void)
+{
+    __disable_irq();
+    if (!enc_interrupt_pending(&mchdrv_hw))
+        __WFI();
+    __enable_irq();
+}
+#endif
+
 uint32_t sys_now(void)
 {
 	LWIP_ASSERT("Unexpected RTC tick interval", rtc_get_ticks_per_second() == 512);
@@ -73,8 +101,18 @@ int main(void)
 
     log_message("Setup completed\n");
 
+#ifdef MCHDRV_USE_INTERRUPTS
+    SysTick_Config(CMU_ClockFreqGet(cmuClock_CORE) / 100);
+#endif
+
     while (1) {
-        mch_net_poll();
+        int work = mch_net_poll();
         sys_check_timeouts();
+#ifdef MCHDRV_USE_INTERRUPTS
+        if (work == 0)
+            mch_sleep();
+#else
+        (void)work;
+#endif
     }
 }
@@ -1,50 +1,406 @@
 #include <netif/mchdrv.h>
 #include <lwip/pbuf.h>
 #include <netif/etharp.h>
+#include <lwip/stats.h>
+#include <lwip/snmp.h>
+#include <lwip/init.h>
+#ifdef MCHDRV_USE_RX_FILTER
+#include <string.h>
+#include <lwip/udp.h>
+#endif
 #if LWIP_IPV6
 #include <lwip/ethip6.h>
 #endif
 #include "enc28j60.h"
 
-void mchdrv_poll(struct netif *netif) {
+/** Maximum number of frames mchdrv_poll processes per call. Can be
+ * overridden in lwipopts.h. */
+#ifndef MCHDRV_RX_BUDGET
+#define MCHDRV_RX_BUDGET 8
+#endif
+
+/** Receive buffer size unless configured in the enc_device_t's
+ * rxbufsize_setting */
+#ifndef MCHDRV_RXBUFSIZE
+#define MCHDRV_RXBUFSIZE (4*1024)
+#endif
+
+#ifdef MCHDRV_USE_SPI_CALIBRATION
+/** Fastest SPI clock enc_spi_calibrate tries, in Hz */
+#ifndef MCHDRV_SPI_MAX_HZ
+#define MCHDRV_SPI_MAX_HZ ENC_SPI_MAX_HZ
+#endif
+#endif
+
+#ifdef MCHDRV_USE_ADAPTIVE_BUFFERS
+/** Number of receive buffer overflows or full transmit queues after which the
+ * memory partitioning is reconsidered */
+#ifndef MCHDRV_ADAPT_THRESHOLD
+#define MCHDRV_ADAPT_THRESHOLD 4
+#endif
+/** Smallest receive buffer the adaptive partitioning shrinks to */
+#ifndef MCHDRV_RXBUFSIZE_MIN
+#define MCHDRV_RXBUFSIZE_MIN (2*1024)
+#endif
+#endif
+
+/* Hand a completely read frame to lwIP */
+static void mchdrv_input(struct netif *netif)
+{
 	err_t result;
 	struct pbuf *buf = NULL;
+	enc_device_t *encdevice = (enc_device_t*)netif->state;
+
+	if (enc_read_received_pbuf_finish(encdevice, &buf) != 0)
+		return;
+
+	LWIP_DEBUGF(NETIF_DEBUG, ("incoming: read into %x\n", (unsigned int)(buf)));
+	result = netif->input(buf, netif);
+	LWIP_DEBUGF(NETIF_DEBUG, ("received with result %d\n", result));
+}
+
+/* lwIP 2 replaced the snmp_* interface counter functions with
+ * MIB2_STATS_NETIF_*; 1.4 has no ifOutErrors counter and gets the errors
+ * counted as discards (MCHDRV_IFOUTERRORS). The extra level of macros lets
+ * the counter name get expanded before it is pasted. */
+#ifdef MIB2_STATS_NETIF_INC
+#define MCHDRV_IFOUTERRORS ifouterrors
+#define MCHDRV_MIB2_INC(netif, counter) MIB2_STATS_NETIF_INC(netif, counter)
+#define MCHDRV_MIB2_ADD(netif, counter, value) MIB2_STATS_NETIF_ADD(netif, counter, value)
+#else
+#define MCHDRV_IFOUTERRORS ifoutdiscards
+#define MCHDRV_MIB2_INC(netif, counter) MCHDRV_SNMP_INC(netif, counter)
+#define MCHDRV_MIB2_ADD(netif, counter, value) MCHDRV_SNMP_ADD(netif, counter, value)
+#define MCHDRV_SNMP_INC(netif, counter) snmp_inc_##counter(netif)
+#define MCHDRV_SNMP_ADD(netif, counter, value) snmp_add_##counter(netif, value)
+#endif
+
+/* Account a finished transmission; called by the driver from within
+ * enc_transmit_poll, which may run in mchdrv_poll or mchdrv_linkoutput */
+static void mchdrv_tx_done(void *arg, const enc_tx_status_t *status)
+{
+	struct netif *netif = (struct netif*)arg;
+	(void)netif; /* unused if SNMP is disabled */
+
+	if (status->result != ENC_TX_OK) {
+		LWIP_DEBUGF(NETIF_DEBUG, ("transmission failed: %d\n", status->result));
+		LINK_STATS_INC(link.err);
+		MCHDRV_MIB2_INC(netif, MCHDRV_IFOUTERRORS);
+		return;
+	}
+
+	LINK_STATS_INC(link.xmit);
+	MCHDRV_MIB2_ADD(netif, ifoutoctets, status->length);
+	if (status->flags & (ENC_TSV_MULTICAST | ENC_TSV_BROADCAST)) {
+		MCHDRV_MIB2_INC(netif, ifoutnucastpkts);
+	} else {
+		MCHDRV_MIB2_INC(netif, ifoutucastpkts);
+	}
+}
+
+#ifdef MCHDRV_USE_RX_FILTER
+/* Is there a UDP pcb that would take a datagram to port? Without UDP
+ * support in lwIP, no port is open. */
+static int mchdrv_udp_port_open(u16_t port)
+{
+#if LWIP_UDP
+	struct udp_pcb *pcb;
+
+	for (pcb = udp_pcbs; pcb != NULL; pcb = pcb->next)
+		if (pcb->local_port == port)
+			return 1;
+#else
+	(void)port;
+#endif
+	return 0;
+}
+
+/* Decide from a frame's first bytes whether lwIP would do anything with it;
+ * see MCHDRV_USE_RX_FILTER in mchdrv.h. */
+static int mchdrv_rx_filter(void *arg, const uint8_t *frame, uint16_t peeklength, uint16_t length)
+{
+	struct netif *netif = (struct netif*)arg;
+	enc_frame_info_t info;
+	(void)length;
+
+	if (peeklength < 14)
+		return ENC_RX_DROP;
+
+	/* unicast that is not for us; only gets here in promiscuous mode */
+	if (!(frame[0] & 0x01) && memcmp(frame, netif->hwaddr, 6) != 0)
+		return ENC_RX_DROP;
+
+	enc_frame_classify(frame, peeklength, &info);
+
+	switch (info.ethertype) {
+	case 0x0806: /* ARP */
+		return ENC_RX_ACCEPT;
+	case 0x0800: /* IPv4 */
+#if LWIP_IPV6
+	case 0x86dd:
+#endif
+		if (info.ipproto == 17 && info.has_ports && !mchdrv_udp_port_open(info.dstport))
+			return ENC_RX_DROP;
+		return ENC_RX_ACCEPT;
+#if ETHARP_SUPPORT_VLAN
+	case 0x8100:
+		return ENC_RX_ACCEPT;
+#endif
+#if PPPOE_SUPPORT
+	case 0x8863:
+	case 0x8864:
+		return ENC_RX_ACCEPT;
+#endif
+	default:
+		return ENC_RX_DROP;
+	}
+}
+#endif
+
+/* Multicast groups can only be left to the hash table filter if lwIP
+ * announces all groups it needs; IPv6 needs multicast for neighbor discovery,
+ * so it is only covered if MLD tells about the groups. */
+#define MCHDRV_MULTICAST_FILTER (!LWIP_IPV6 || LWIP_IPV6_MLD)
+
+#if MCHDRV_MULTICAST_FILTER
+/* lwIP 2 changed the action argument's type and constants */
+#if LWIP_VERSION_MAJOR >= 2
+typedef enum netif_mac_filter_action mchdrv_filter_action_t;
+#define MCHDRV_ADD_MAC_FILTER NETIF_ADD_MAC_FILTER
+#define MCHDRV_IP4_GROUP_T const ip4_addr_t
+#define MCHDRV_IP6_GROUP_T const ip6_addr_t
+#else
+typedef u8_t mchdrv_filter_action_t;
+#define MCHDRV_ADD_MAC_FILTER IGMP_ADD_MAC_FILTER
+#define MCHDRV_IP4_GROUP_T ip_addr_t
+#define MCHDRV_IP6_GROUP_T ip6_addr_t
+#endif
+
+static err_t mchdrv_mac_filter(struct netif *netif, const uint8_t mac[6], mchdrv_filter_action_t action)
+{
+	enc_device_t *encdevice = (enc_device_t*)netif->state;
+	int result;
+
+	if (action == MCHDRV_ADD_MAC_FILTER)
+		result = enc_multicast_add(encdevice, mac);
+	else
+		result = enc_multicast_remove(encdevice, mac);
+
+	return result == 0 ? ERR_OK : ERR_VAL;
+}
+
+#if LWIP_IGMP
+/* IPv4 multicast groups map to 01:00:5e plus their lower 23 bits */
+static err_t mchdrv_igmp_mac_filter(struct netif *netif, MCHDRV_IP4_GROUP_T *group, mchdrv_filter_action_t action)
+{
+	uint8_t mac[6] = {0x01, 0x00, 0x5e, ip4_addr2(group) & 0x7f, ip4_addr3(group), ip4_addr4(group)};
 
-	uint8_t epktcnt;
+	return mchdrv_mac_filter(netif, mac, action);
+}
+#endif
+
+#if LWIP_IPV6 && LWIP_IPV6_MLD
+/* IPv6 multicast groups map to 33:33 plus their lower 32 bits */
+static err_t mchdrv_mld_mac_filter(struct netif *netif, MCHDRV_IP6_GROUP_T *group, mchdrv_filter_action_t action)
+{
+	const u8_t *low = (const u8_t*)&group->addr[3];
+	uint8_t mac[6] = {0x33, 0x33, low[0], low[1], low[2], low[3]};
+
+	return mchdrv_mac_filter(netif, mac, action);
+}
+#endif
+#endif
+
+static void mchdrv_update_link(struct netif *netif)
+{
 	bool linkstate;
 	enc_device_t *encdevice = (enc_device_t*)netif->state;
 
-	linkstate = enc_MII_read(encdevice, ENC_PHSTAT1) & (1 << 2);
+	linkstate = enc_link_state(encdevice);
+
+	/* only notify lwIP about transitions */
+	if (linkstate && !netif_is_link_up(netif)) {
+		LWIP_DEBUGF(NETIF_DEBUG, ("link up, %s duplex\n", enc_duplex(encdevice) == ENC_DUPLEX_FULL ? "full" : "half"));
+		netif_set_link_up(netif);
+	}
+	else if (!linkstate && netif_is_link_up(netif)) netif_set_link_down(netif);
+}
+
+#ifdef MCHDRV_USE_FAST_REPLIES
+#if LWIP_VERSION_MAJOR >= 2
+#define MCHDRV_IP4_ADDR(netif) netif_ip4_addr(netif)
+#else
+#define MCHDRV_IP4_ADDR(netif) (&(netif)->ip_addr)
+#endif
+
+/* Keep the driver answering ARP and pings for the current address */
+static void mchdrv_update_fast_reply(struct netif *netif)
+{
+	enc_device_t *encdevice = (enc_device_t*)netif->state;
+
+	if (netif_is_up(netif) && MCHDRV_IP4_ADDR(netif)->addr != 0)
+		enc_fast_reply_set(encdevice, (const uint8_t*)&MCHDRV_IP4_ADDR(netif)->addr);
+	else
+		enc_fast_reply_set(encdevice, NULL);
+}
+#endif
+
+#ifdef MCHDRV_USE_ADAPTIVE_BUFFERS
+/* Move a transmit slot's worth of memory to the receive buffer if it
+ * overflowed more often than the transmit slots ran full since the last
+ * decision, or the other way round. The repartitioning needs both directions
+ * to be idle; until they are, this is tried again on every call. */
+static void mchdrv_adapt_buffers(struct netif *netif)
+{
+	enc_device_t *encdevice = (enc_device_t*)netif->state;
+	u32_t overflows = encdevice->rx_overflows - encdevice->adapt.rx_overflows;
+	u32_t queue_full = encdevice->txstats.queue_full - encdevice->adapt.queue_full;
+	u16_t rxbufsize = encdevice->rxbufsize;
+
+	if (overflows < MCHDRV_ADAPT_THRESHOLD && queue_full < MCHDRV_ADAPT_THRESHOLD)
+		return;
 
-	if (linkstate) netif_set_link_up(netif);
-	else netif_set_link_down(netif);
+	if (overflows >= queue_full) {
+		if (rxbufsize + encdevice->tx.slotsize > ENC_RXBUFSIZE_MAX)
+			rxbufsize = ENC_RXBUFSIZE_MAX;
+		else
+			rxbufsize += encdevice->tx.slotsize;
+	} else if (encdevice->tx.count < ENC_TX_SLOTS) {
+		if (rxbufsize < MCHDRV_RXBUFSIZE_MIN + encdevice->tx.slotsize)
+			rxbufsize = MCHDRV_RXBUFSIZE_MIN;
+		else
+			rxbufsize -= encdevice->tx.slotsize;
+	}
+
+	if (rxbufsize != encdevice->rxbufsize) {
+		if (enc_rx_buffer_resize(encdevice, rxbufsize) != 0)
+			return;
+		LWIP_DEBUGF(NETIF_DEBUG, ("receive buffer resized to %u bytes, %u transmit slots\n", rxbufsize, encdevice->tx.count));
+	}
 
-	epktcnt = enc_RCR(encdevice, ENC_EPKTCNT);
+	encdevice->adapt.rx_overflows = encdevice->rx_overflows;
+	encdevice->adapt.queue_full = encdevice->txstats.queue_full;
+}
+#endif
+
+int mchdrv_poll(struct netif *netif) {
+	int work = 0;
+	uint8_t epktcnt = 0;
+	enc_device_t *encdevice = (enc_device_t*)netif->state;
+#ifdef MCHDRV_USE_INTERRUPTS
+	uint8_t eir;
+#endif
+
+	/* A frame is still streaming in from the previous call; come back when
+	 * the backend signals completion. */
+	if (encdevice->rx_pending != NULL) {
+		if (enc_transfer_busy(encdevice))
+			return work;
+		mchdrv_input(netif);
+		work++;
+	}
+
+#ifdef MCHDRV_USE_ADAPTIVE_BUFFERS
+	mchdrv_adapt_buffers(netif);
+#endif
 
-	if (epktcnt) {
-		if (enc_read_received_pbuf(encdevice, &buf) == 0)
-		{
-			LWIP_DEBUGF(NETIF_DEBUG, ("incoming: %d packages, first read into %x\n", epktcnt, (unsigned int)(buf)));
-			result = netif->input(buf, netif);
-			LWIP_DEBUGF(NETIF_DEBUG, ("received with result %d\n", result));
-		} else {
+#ifdef MCHDRV_USE_FAST_REPLIES
+	mchdrv_update_fast_reply(netif);
+#endif
+
+#ifdef MCHDRV_USE_INTERRUPTS
+	/* Nothing happened as long as the INT line is high; no need to
+	 * bother the SPI bus. */
+	if (!enc_interrupt_pending(encdevice)) {
+		/* a stuck transmission (errata #12) raises no interrupt, its
+		 * timeout is only noticed by polling */
+		if (encdevice->tx.queued)
+			enc_transmit_poll(encdevice);
+		return work;
+	}
+
+	eir = enc_interrupt_flags(encdevice);
+	enc_interrupt_clear(encdevice, eir);
+
+	if (eir & ENC_EIR_LINKIF)
+		mchdrv_update_link(netif);
+	if (eir & (ENC_EIR_TXIF | ENC_EIR_TXERIF))
+		enc_transmit_poll(encdevice);
+	if (eir & ENC_EIR_RXERIF) {
+		LWIP_DEBUGF(NETIF_DEBUG, ("receive buffer overflow\n"));
+		encdevice->rx_overflows++;
+	}
+
+	/* Not relying on ENC_EIR_PKTIF: as per errata #6, it does not
+	 * reliably report pending frames, so EPKTCNT is read whenever the line
+	 * is asserted for whatever reason. */
+#else
+	mchdrv_update_link(netif);
+
+	/* start the next queued frame if the last one is done */
+	if (encdevice->tx.queued)
+		enc_transmit_poll(encdevice);
+
+#ifdef MCHDRV_USE_ADAPTIVE_BUFFERS
+	/* overflows are only noticed by their flag */
+	if (enc_interrupt_flags(encdevice) & ENC_EIR_RXERIF) {
+		enc_interrupt_clear(encdevice, ENC_EIR_RXERIF);
+		encdevice->rx_overflows++;
+	}
+#endif
+#endif
+
+	/* EPKTCNT is only read again when the frames counted last time are
+	 * used up, to pick up frames that arrived in the meantime. */
+	while (work < MCHDRV_RX_BUDGET) {
+		if (epktcnt == 0) {
+			epktcnt = enc_RCR(encdevice, ENC_EPKTCNT);
+			if (epktcnt == 0)
+				break;
+			LWIP_DEBUGF(NETIF_DEBUG, ("incoming: %d packages\n", epktcnt));
+		}
+
+		epktcnt--;
+		work++;
+
+		if (enc_read_received_pbuf_start(encdevice) != 0) {
 			/* FIXME: error reporting */
 			LWIP_DEBUGF(NETIF_DEBUG, ("didn't receive.\n"));
+			continue;
 		}
+
+		/* with a DMA capable backend, lwIP gets to run until the next
+		 * call while the frame is being read */
+		if (enc_transfer_busy(encdevice))
+			break;
+
+		mchdrv_input(netif);
 	}
+
+	/* hold the link partner off while the frames left are too many */
+	enc_flow_control_poll(encdevice);
+
+	return work;
 }
 
 static err_t mchdrv_linkoutput(struct netif *netif, struct pbuf *p)
 {
 	enc_device_t *encdevice = (enc_device_t*)netif->state;
-	enc_transmit_pbuf(encdevice, p);
-	LWIP_DEBUGF(NETIF_DEBUG, ("sent %d bytes.\n", p->tot_len));
-	/* FIXME: evaluate result state */
+	if (enc_transmit_pbuf(encdevice, p) != 0) {
+		LWIP_DEBUGF(NETIF_DEBUG, ("frame of %d bytes too large.\n", p->tot_len));
+		LINK_STATS_INC(link.lenerr);
+		MCHDRV_MIB2_INC(netif, ifoutdiscards);
+		return ERR_BUF;
+	}
+	LWIP_DEBUGF(NETIF_DEBUG, ("queued %d bytes.\n", p->tot_len));
+	/* The frame is sent asynchronously; its outcome gets accounted by
+	 * mchdrv_tx_done. */
 	return ERR_OK;
 }
 
 err_t mchdrv_init(struct netif *netif) {
 	int result;
+	u16_t rxbufsize;
 	enc_device_t *encdevice = (enc_device_t*)netif->state;
 
 	LWIP_DEBUGF(NETIF_DEBUG, ("Starting mchdrv_init.\n"));
@@ -55,17 +411,124 @@ err_t mchdrv_init(struct netif *netif) {
 		LWIP_DEBUGF(NETIF_DEBUG, ("Error %d in enc_setup, interface setup aborted.\n", result));
 		return ERR_IF;
 	}
+#ifdef MCHDRV_USE_SPI_CALIBRATION
+	if (enc_spi_calibrate(encdevice, MCHDRV_SPI_MAX_HZ) == 0)
+	{
+		LWIP_DEBUGF(NETIF_DEBUG, ("SPI calibration failed, interface setup aborted.\n"));
+		return ERR_IF;
+	}
+#endif
 	result = enc_bist_manual(encdevice);
 	if (result != 0)
 	{
 		LWIP_DEBUGF(NETIF_DEBUG, ("Error %d in enc_bist_manual, interface setup aborted.\n", result));
 		return ERR_IF;
 	}
-	enc_ethernet_setup(encdevice, 4*1024, netif->hwaddr);
-	/* enabling this unconditonally: there seems not to be a generic way by
-	 * which protocols indicate their multicast requirements to the netif,
-	 * going for "always on" for now */
+	rxbufsize = encdevice->rxbufsize_setting != 0 ? encdevice->rxbufsize_setting : MCHDRV_RXBUFSIZE;
+	if (rxbufsize > ENC_RXBUFSIZE_MAX)
+	{
+		LWIP_DEBUGF(NETIF_DEBUG, ("Receive buffer size %u leaves no room for transmission, interface setup aborted.\n", rxbufsize));
+		return ERR_ARG;
+	}
+	enc_ethernet_setup(encdevice, rxbufsize, netif->hwaddr);
+#if MCHDRV_MULTICAST_FILTER
+	/* only groups lwIP subscribes to pass the hash table filter */
+	enc_set_multicast_reception(encdevice, 0);
+#if LWIP_IGMP
+	netif->igmp_mac_filter = mchdrv_igmp_mac_filter;
+	netif->flags |= NETIF_FLAG_IGMP;
+#endif
+#if LWIP_IPV6 && LWIP_IPV6_MLD
+	{
+		/* all-nodes (ff02::1) is used without being joined */
+		static const uint8_t allnodes[6] = {0x33, 0x33, 0, 0, 0, 1};
+		enc_multicast_add(encdevice, allnodes);
+	}
+	netif->mld_mac_filter = mchdrv_mld_mac_filter;
+#ifdef NETIF_FLAG_MLD6
+	netif->flags |= NETIF_FLAG_MLD6;
+#endif
+#endif
+#else
+	/* IPv6 without MLD does not announce the groups it needs (eg. for
+	 * neighbor discovery), so all multicast is received */
 	enc_set_multicast_reception(encdevice, 1);
+#endif
+
+	enc_link_monitor_start(encdevice);
+
+	encdevice->tx_done = mchdrv_tx_done;
+	encdevice->tx_done_arg = netif;
+
+	/* Let the chip compute the checksums lwIP does not generate. */
+#if LWIP_IPV6 && LWIP_IPV6_FRAG && (!CHECKSUM_GEN_UDP || !CHECKSUM_GEN_TCP)
+#error "The ENC28J60 can't fill in UDP or TCP checksums of fragmented IPv6 packets; enable CHECKSUM_GEN_UDP and CHECKSUM_GEN_TCP, or disable LWIP_IPV6_FRAG"
+#endif
+	encdevice->offload = 0;
+#if !CHECKSUM_GEN_IP
+	encdevice->offload |= ENC_OFFLOAD_TX_IP;
+#endif
+#if !CHECKSUM_GEN_UDP
+	encdevice->offload |= ENC_OFFLOAD_TX_UDP;
+#endif
+#if !CHECKSUM_GEN_TCP
+	encdevice->offload |= ENC_OFFLOAD_TX_TCP;
+#endif
+#if defined(CHECKSUM_GEN_ICMP) && !CHECKSUM_GEN_ICMP
+	encdevice->offload |= ENC_OFFLOAD_TX_ICMP;
+#endif
+	/* Likewise, let it verify received checksums lwIP does not check;
+	 * frames failing them get dropped before they are read. */
+#if !CHECKSUM_CHECK_IP
+	encdevice->offload |= ENC_OFFLOAD_RX_IP;
+#endif
+#if !CHECKSUM_CHECK_UDP
+	encdevice->offload |= ENC_OFFLOAD_RX_UDP;
+#endif
+#if !CHECKSUM_CHECK_TCP
+	encdevice->offload |= ENC_OFFLOAD_RX_TCP;
+#endif
+#if defined(CHECKSUM_CHECK_ICMP) && !CHECKSUM_CHECK_ICMP
+	encdevice->offload |= ENC_OFFLOAD_RX_ICMP;
+#endif
+#if LWIP_IPV6 && defined(CHECKSUM_CHECK_ICMP6) && !CHECKSUM_CHECK_ICMP6
+	encdevice->offload |= ENC_OFFLOAD_RX_ICMP6;
+#endif
+#if LWIP_CHECKSUM_CTRL_PER_NETIF
+	/* with per-netif control, the chip does them regardless of the
+	 * global settings. Fragments of IPv6 datagrams lack the transport
+	 * header the chip needs, so lwIP keeps generating UDP and TCP
+	 * checksums if it fragments IPv6. Likewise, lwIP keeps checking
+	 * transport checksums of frames the chip can't check: reassembled
+	 * IPv4 datagrams, and any IPv6 packet might carry extension
+	 * headers. */
+	{
+		u16_t chksum_flags = NETIF_CHECKSUM_ENABLE_ALL & ~(
+				NETIF_CHECKSUM_GEN_IP | NETIF_CHECKSUM_GEN_ICMP |
+				NETIF_CHECKSUM_CHECK_IP);
+#if !IP_REASSEMBLY
+		chksum_flags &= ~NETIF_CHECKSUM_CHECK_ICMP;
+#if !LWIP_IPV6
+		chksum_flags &= ~(NETIF_CHECKSUM_CHECK_UDP | NETIF_CHECKSUM_CHECK_TCP);
+#endif
+#endif
+#if !(LWIP_IPV6 && LWIP_IPV6_FRAG)
+		chksum_flags &= ~(NETIF_CHECKSUM_GEN_UDP | NETIF_CHECKSUM_GEN_TCP);
+#endif
+		NETIF_SET_CHECKSUM_CTRL(netif, chksum_flags);
+	}
+	encdevice->offload |= ENC_OFFLOAD_TX_IP | ENC_OFFLOAD_TX_UDP | ENC_OFFLOAD_TX_TCP | ENC_OFFLOAD_TX_ICMP | ENC_OFFLOAD_RX;
+#endif
+#ifdef MCHDRV_USE_RX_FILTER
+	encdevice->rx_filter = mchdrv_rx_filter;
+	encdevice->rx_filter_arg = netif;
+#endif
+
+#ifdef MCHDRV_USE_INTERRUPTS
+	enc_interrupts_setup(encdevice, ENC_EIE_PKTIE | ENC_EIE_TXIE | ENC_EIE_RXERIE | ENC_EIE_LINKIE);
+	/* from now on, the link state is only updated on changes */
+	mchdrv_update_link(netif);
+#endif
 
 	netif->output = etharp_output;
 #if LWIP_IPV6
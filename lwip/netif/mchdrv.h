@@ -7,10 +7,66 @@
 #include <lwip/err.h>
 
 /** netif init function; have this called by passing it to netif_add, along
- * with a pointer to an uninitialized enc_device_t state. The MAC address has
- * to be configured beforehand in the netif, and configured on the card. */
+ * with a pointer to a zero-initialized enc_device_t state (eg. a static one,
+ * or one cleared with memset) in which only the optional configuration fields
+ * below may have been set. The driver does not initialize those, so garbage
+ * in them gets used. The MAC address has to be configured beforehand in the
+ * netif, and configured on the card.
+ *
+ * Optional configuration fields of the state, all left alone if 0:
+ *
+ * - rxbufsize_setting chooses the receive buffer size (MCHDRV_RXBUFSIZE,
+ *   4 KiB unless configured otherwise, if left 0); the rest of the chip's
+ *   memory holds frames being transmitted.
+ * - duplex_setting selects full duplex operation (ENC_DUPLEX_FULL).
+ * - flow_high / flow_low enable flow control (see enc_flow_control_poll,
+ *   which mchdrv_poll calls).
+ * - clock / clock_hz bound the waits for the chip in time rather than in
+ *   register reads.
+ * - hwdev is passed to the hardware backend.
+ *
+ * When built with MCHDRV_USE_SPI_CALIBRATION (which requires a backend
+ * defining ENCHW_HAS_BAUDRATE), the SPI clock is raised to the fastest rate
+ * that passes enc_spi_calibrate's tests, up to MCHDRV_SPI_MAX_HZ, before the
+ * chip is configured. The result can be read back with enchw_get_baudrate. */
 err_t mchdrv_init(struct netif *netif);
-/** Call this in the main loop */
-void mchdrv_poll(struct netif *netif);
+/** Call this in the main loop. Up to MCHDRV_RX_BUDGET pending frames (8
+ * unless configured otherwise in lwipopts.h) are received per call; the link
+ * state is only checked once per call.
+ *
+ * Returns the number of frames processed. If that equals the budget, more
+ * frames are probably waiting and the caller should not go to sleep.
+ *
+ * If the hardware backend reads frames in the background (DMA), a frame is
+ * only handed to lwIP on a later call, after the transfer has completed.
+ *
+ * When built with MCHDRV_USE_INTERRUPTS, the ENC28J60's INT line is
+ * configured to report received frames, transmissions, receive errors and
+ * link changes, and this returns without accessing the chip while the line is
+ * not asserted, except for checking on frames still being sent (a stuck
+ * transmission raises no interrupt, see enc_transmit_poll). The main loop may
+ * then sleep between calls, woken by the INT line's GPIO interrupt and a
+ * timer for lwIP's timeouts, which also keeps those checks going. As INT is held
+ * low while anything is pending, a frame arriving during a call produces no
+ * new edge: the loop must check enc_interrupt_pending (or
+ * enchw_interrupt_pending) right before sleeping, with interrupts masked
+ * between the check and the sleep instruction, and not sleep if it is set.
+ * The netblink example shows this.
+ *
+ * When built with MCHDRV_USE_RX_FILTER, only the first ENC_RX_PEEK_SIZE bytes
+ * of a frame are read at first, and frames lwIP would discard anyway are
+ * skipped without reading the rest: unicast to other addresses, unsupported
+ * ethertypes and UDP to ports without a pcb. (Unlike lwIP itself, this sends
+ * no ICMP port unreachable messages, and raw pcbs don't see such datagrams.)
+ *
+ * When built with MCHDRV_USE_FAST_REPLIES, ARP requests for and pings to the
+ * interface's IPv4 address are answered by the driver (see
+ * enc_fast_reply_set) without reading their payload; lwIP never sees them.
+ *
+ * When built with MCHDRV_USE_ADAPTIVE_BUFFERS, receive buffer overflows and
+ * full transmit queues are counted, and memory is moved between the receive
+ * buffer and the transmit slots accordingly when both are idle.
+ * */
+int mchdrv_poll(struct netif *netif);
 
 #endif